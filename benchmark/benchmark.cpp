@@ -0,0 +1,445 @@
+// Generates a synthetic project and measures how long each phase of
+// matmake2 takes on it. The compiler is replaced with a stub so that the
+// time is spent in matmake2 and not in the compiler
+
+#include "coordinator.h"
+#include "createtasks.h"
+#include "filesystem.h"
+#include "graphcache.h"
+#include "makefile.h"
+#include "matmakefile.h"
+#include "ninja.h"
+#include "parsematmakefile.h"
+#include "settings.h"
+#include "statcache.h"
+#include "syntheticproject.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <type_traits>
+
+namespace {
+
+const char *helpText = R"_(
+usage:
+matmake2-benchmark [options]
+
+Generates a project, builds it with a stub compiler and prints the time of
+each phase as json
+
+options:
+--help -h                  print this text
+--files [n]                number of source files (default 1000)
+--files-per-library [n]    source files in each library (default 100)
+--include-depth [n]        levels of headers (default 3)
+--headers-per-level [n]    headers on each level (default 50)
+--header-fan-in [n]        headers included by each file (default 4)
+--modules [n]              number of c++20 module files (default 0)
+--module-shape [shape]     how modules imports each other: chain, tree or
+                           dag (default chain)
+--module-fan-in [n]        modules imported by each module in a dag
+                           (default 2)
+--roots [n]                number of root targets (default 1)
+--seed [n]                 seed for the generated project (default 1)
+--dir [dir]                where to generate the project
+                           (default matmake2-benchmark-project)
+--output -o [file]         write the result to a file instead of stdout
+--keep                     do not remove the project when done
+-j [n]                     number of worker threads
+--verbose -v               do not hide the output from matmake2
+
+)_";
+
+struct BenchmarkSettings {
+    SyntheticProject project;
+    filesystem::path dir = "matmake2-benchmark-project";
+    filesystem::path output;
+    bool keep = false;
+    bool verbose = false;
+    size_t numThreads = std::thread::hardware_concurrency();
+};
+
+size_t toSize(const std::string &str) {
+    auto ss = std::istringstream{str};
+    size_t value = 0;
+    if (!(ss >> value)) {
+        throw std::runtime_error{"expected a number, got " + str};
+    }
+    return value;
+}
+
+BenchmarkSettings parseArguments(const std::vector<std::string> &args) {
+    auto settings = BenchmarkSettings{};
+    auto &project = settings.project;
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        auto &arg = args.at(i);
+
+        auto next = [&]() -> const std::string & {
+            if (++i >= args.size()) {
+                throw std::runtime_error{"expected value after " + arg};
+            }
+            return args.at(i);
+        };
+
+        if (arg == "-h" || arg == "--help") {
+            std::cout << helpText;
+            std::exit(0);
+        }
+        else if (arg == "--files") {
+            project.numFiles = toSize(next());
+        }
+        else if (arg == "--files-per-library") {
+            project.filesPerLibrary = toSize(next());
+        }
+        else if (arg == "--include-depth") {
+            project.includeDepth = toSize(next());
+        }
+        else if (arg == "--headers-per-level") {
+            project.headersPerLevel = toSize(next());
+        }
+        else if (arg == "--header-fan-in") {
+            project.headerFanIn = toSize(next());
+        }
+        else if (arg == "--modules") {
+            project.numModules = toSize(next());
+        }
+        else if (arg == "--module-shape") {
+            project.moduleShape = toModuleShape(next());
+        }
+        else if (arg == "--module-fan-in") {
+            project.moduleFanIn = toSize(next());
+        }
+        else if (arg == "--roots") {
+            project.numRoots = std::max<size_t>(toSize(next()), 1);
+        }
+        else if (arg == "--seed") {
+            project.seed = static_cast<uint32_t>(toSize(next()));
+        }
+        else if (arg == "--dir") {
+            settings.dir = next();
+        }
+        else if (arg == "--output" || arg == "-o") {
+            settings.output = next();
+        }
+        else if (arg == "--keep") {
+            settings.keep = true;
+        }
+        else if (arg == "-j") {
+            settings.numThreads = toSize(next());
+        }
+        else if (arg == "--verbose" || arg == "-v") {
+            settings.verbose = true;
+        }
+        else {
+            throw std::runtime_error{"unknown argument " + arg};
+        }
+    }
+
+    return settings;
+}
+
+//! The command that runs this program as a stub compiler
+std::string stubCommand(const char *argv0) {
+#ifdef MATMAKE_USING_WINDOWS
+    auto path = filesystem::absolute(argv0);
+#else
+    auto path = filesystem::exists("/proc/self/exe")
+                    ? filesystem::read_symlink("/proc/self/exe")
+                    : filesystem::absolute(argv0);
+#endif
+    return "\"" + path.string() + "\" --stub";
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+//! Hide what matmake2 prints while it is alive, since it is not interesting
+//! and writing it takes time
+class MuteOutput {
+public:
+    MuteOutput(bool isEnabled)
+        : _old{isEnabled ? std::cout.rdbuf(nullptr) : nullptr} {}
+
+    MuteOutput(const MuteOutput &) = delete;
+    MuteOutput &operator=(const MuteOutput &) = delete;
+
+    ~MuteOutput() {
+        if (_old) {
+            std::cout.clear();
+            std::cout.rdbuf(_old);
+        }
+    }
+
+private:
+    std::streambuf *_old;
+};
+
+//! Named durations in the order they was measured
+class Phases {
+public:
+    template <typename F>
+    auto measure(const std::string &name, F f) {
+        auto start = std::chrono::steady_clock::now();
+        if constexpr (std::is_void_v<decltype(f())>) {
+            f();
+            add(name, secondsSince(start));
+        }
+        else {
+            auto ret = f();
+            add(name, secondsSince(start));
+            return ret;
+        }
+    }
+
+    //! Add the phases that was traced since the trace had numSpans spans
+    void addTraced(size_t numSpans,
+                   std::initializer_list<std::string_view> names) {
+        auto spans = trace()->spans();
+        for (auto name : names) {
+            for (size_t i = numSpans; i < spans.size(); ++i) {
+                auto &span = spans.at(i);
+                if (span.category == "phase" && span.name == name) {
+                    add(span.name, span.duration / 1e6);
+                }
+            }
+        }
+    }
+
+    void add(const std::string &name, double seconds) {
+        _phases.emplace_back(name, seconds);
+    }
+
+    void print(std::ostream &stream) const {
+        stream << "{";
+        for (size_t i = 0; i < _phases.size(); ++i) {
+            stream << (i ? ", " : "") << "\"" << _phases.at(i).first
+                   << "\": " << _phases.at(i).second;
+        }
+        stream << "}";
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> _phases;
+};
+
+constexpr auto maxSettleBuilds = size_t{10};
+
+struct RootResult {
+    std::string name;
+    size_t numTasks = 0;
+    bool isGraphCached = false;
+    size_t numSettleBuilds = 0;
+    Phases cold;   // First build
+    Phases noOp;   // Nothing is changed, without the graph cache
+    Phases cached; // Nothing is changed, the graph is loaded from the cache
+};
+
+MatmakeFile parseProject(const Json &roots, const std::string &target) {
+    auto json = parseMatmakefile(filesystem::path{"Matmakefile"});
+    for (auto &root : roots) {
+        json.push_back(root);
+    }
+    return MatmakeFile{json, target};
+}
+
+RootResult benchmarkRoot(const Json &roots,
+                         const std::string &target,
+                         const Settings &settings) {
+    auto result = RootResult{};
+    result.name = target;
+
+    auto build = [&](Phases &phases, TaskList &tasks) {
+        phases.measure("build", [&] {
+            if (Coordinator{}.execute(tasks, settings)) {
+                throw std::runtime_error{"build failed for " + target};
+            }
+        });
+    };
+
+    // Every run starts without cached file information, like a new process
+    {
+        auto &phases = result.cold;
+        statCache().clear();
+        auto file = phases.measure(
+            "parse", [&] { return parseProject(roots, target); });
+        auto numSpans = trace()->spans().size();
+        auto tasks = createTasks(file, target, true);
+        phases.addTraced(
+            numSpans,
+            {"createTasks", "prescan", "saveGraphCache", "calculateState"});
+        result.numTasks = tasks.size();
+
+        phases.measure("ninja", [&] { printNinja(settings, tasks); });
+        phases.measure("makefile", [&] { printMakefile(settings, tasks); });
+        build(phases, tasks);
+
+        // The stub is so fast that outputs can get the same time stamp as
+        // their inputs on file systems with coarse time stamps, which makes
+        // them look out of date. Build until nothing is left so that the
+        // no-op builds below has nothing to do. Tasks without output, like
+        // the root, is always ready and is not counted
+        for (; result.numSettleBuilds < maxSettleBuilds;
+             ++result.numSettleBuilds) {
+            statCache().clear();
+            auto settleTasks = createTasks(file, target);
+            if (std::none_of(
+                    settleTasks.begin(), settleTasks.end(), [](auto &task) {
+                        return task->state() == TaskState::DirtyReady &&
+                               !task->out().empty();
+                    })) {
+                break;
+            }
+            Coordinator{}.execute(settleTasks, settings);
+        }
+    }
+
+    {
+        auto &phases = result.noOp;
+        statCache().clear();
+        auto file = phases.measure(
+            "parse", [&] { return parseProject(roots, target); });
+        auto numSpans = trace()->spans().size();
+        auto tasks = createTasks(file, target);
+        phases.addTraced(numSpans,
+                         {"createTasks", "prescan", "calculateState"});
+        build(phases, tasks);
+    }
+
+    {
+        auto &phases = result.cached;
+        statCache().clear();
+        auto tasks = phases.measure("loadGraphCache",
+                                    [&] { return loadGraphCache(target); });
+        result.isGraphCached = tasks.has_value();
+        if (tasks) {
+            phases.measure("calculateState", [&] { calculateState(*tasks); });
+            build(phases, *tasks);
+        }
+    }
+
+    return result;
+}
+
+void printResult(std::ostream &stream,
+                 const BenchmarkSettings &settings,
+                 double generateSeconds,
+                 const std::vector<RootResult> &results) {
+    auto &project = settings.project;
+
+    stream << "{\n";
+    stream << "  \"project\": {\n"
+           << "    \"files\": " << project.numFiles << ",\n"
+           << "    \"filesPerLibrary\": " << project.filesPerLibrary << ",\n"
+           << "    \"includeDepth\": " << project.includeDepth << ",\n"
+           << "    \"headersPerLevel\": " << project.headersPerLevel << ",\n"
+           << "    \"headerFanIn\": " << project.headerFanIn << ",\n"
+           << "    \"modules\": " << project.numModules << ",\n"
+           << "    \"moduleShape\": \"" << toString(project.moduleShape)
+           << "\",\n"
+           << "    \"moduleFanIn\": " << project.moduleFanIn << ",\n"
+           << "    \"roots\": " << project.numRoots << ",\n"
+           << "    \"seed\": " << project.seed << "\n"
+           << "  },\n";
+    stream << "  \"threads\": " << settings.numThreads << ",\n";
+    stream << "  \"generate\": " << generateSeconds << ",\n";
+    stream << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto &result = results.at(i);
+        stream << "    {\n"
+               << "      \"name\": \"" << result.name << "\",\n"
+               << "      \"tasks\": " << result.numTasks << ",\n"
+               << "      \"graphCached\": "
+               << (result.isGraphCached ? "true" : "false") << ",\n"
+               << "      \"settleBuilds\": " << result.numSettleBuilds
+               << ",\n";
+        stream << "      \"cold\": ";
+        result.cold.print(stream);
+        stream << ",\n      \"noOp\": ";
+        result.noOp.print(stream);
+        stream << ",\n      \"cached\": ";
+        result.cached.print(stream);
+        stream << "\n    }" << ((i + 1 < results.size()) ? ",\n" : "\n");
+    }
+    stream << "  ]\n";
+    stream << "}\n";
+}
+
+int runBenchmark(const BenchmarkSettings &settings, const char *argv0) {
+    auto &project = settings.project;
+    auto dir = filesystem::absolute(settings.dir);
+
+    if (filesystem::exists(dir)) {
+        throw std::runtime_error{dir.string() +
+                                 " already exists, select a new directory "
+                                 "with --dir"};
+    }
+
+    auto generateStart = std::chrono::steady_clock::now();
+    generateSyntheticProject(project, dir);
+    auto generateSeconds = secondsSince(generateStart);
+
+    auto roots = createStubRoots(project, stubCommand(argv0));
+    auto oldPath = filesystem::current_path();
+    filesystem::current_path(dir);
+
+    // The phases inside createTasks() is measured with the trace
+    startTrace();
+
+    auto results = std::vector<RootResult>{};
+    {
+        auto mute = MuteOutput{!settings.verbose};
+        for (size_t i = 0; i < project.numRoots; ++i) {
+            auto buildSettings = Settings{};
+            buildSettings.target = syntheticRootName(i);
+            buildSettings.skipBuild = true; // Only for the generators
+            buildSettings.numThreads = settings.numThreads;
+            results.push_back(
+                benchmarkRoot(roots, buildSettings.target, buildSettings));
+        }
+    }
+
+    filesystem::current_path(oldPath);
+    if (!settings.keep) {
+        filesystem::remove_all(dir);
+    }
+
+    if (settings.output.empty()) {
+        printResult(std::cout, settings, generateSeconds, results);
+    }
+    else {
+        auto file = std::ofstream{settings.output};
+        if (!file.is_open()) {
+            throw std::runtime_error{"could not write to " +
+                                     settings.output.string()};
+        }
+        printResult(file, settings, generateSeconds, results);
+    }
+
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    auto args = std::vector<std::string>{argv + 1, argv + argc};
+
+    try {
+        if (!args.empty() && args.front() == "--stub") {
+            return runStubCompiler({args.begin() + 1, args.end()});
+        }
+
+        return runBenchmark(parseArguments(args), argv[0]);
+    }
+    catch (std::runtime_error &e) {
+        std::cerr << "error: " << e.what() << "\n";
+        return 1;
+    }
+}
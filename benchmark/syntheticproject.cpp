@@ -0,0 +1,307 @@
+#include "syntheticproject.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <stdexcept>
+
+namespace {
+
+std::string headerName(size_t level, size_t i) {
+    return "h_" + std::to_string(level) + "_" + std::to_string(i) + ".h";
+}
+
+std::string moduleName(size_t i) {
+    return "m" + std::to_string(i);
+}
+
+size_t numLibraries(const SyntheticProject &project) {
+    auto perLibrary = std::max<size_t>(project.filesPerLibrary, 1);
+    return (project.numFiles + perLibrary - 1) / perLibrary;
+}
+
+//! Pick up to count different numbers below max
+std::set<size_t> pick(std::mt19937 &random, size_t count, size_t max) {
+    auto ret = std::set<size_t>{};
+    count = std::min(count, max);
+    while (ret.size() < count) {
+        // Modulo instead of a distribution so that the projects is the same
+        // with every standard library
+        ret.insert(random() % max);
+    }
+    return ret;
+}
+
+void writeIncludes(std::ostream &file,
+                   const SyntheticProject &project,
+                   std::mt19937 &random,
+                   size_t level) {
+    if (level >= project.includeDepth) {
+        return;
+    }
+    for (auto i : pick(random, project.headerFanIn, project.headersPerLevel)) {
+        file << "#include \"" << headerName(level, i) << "\"\n";
+    }
+}
+
+//! The modules that a module imports
+std::vector<size_t> moduleImports(const SyntheticProject &project,
+                                  std::mt19937 &random,
+                                  size_t i) {
+    if (i == 0) {
+        return {};
+    }
+    switch (project.moduleShape) {
+    case ModuleShape::Chain:
+        return {i - 1};
+    case ModuleShape::Tree:
+        return {(i - 1) / 2};
+    case ModuleShape::Dag: {
+        auto imports = pick(random, project.moduleFanIn, i);
+        return {imports.begin(), imports.end()};
+    }
+    }
+    return {};
+}
+
+void generateHeaders(const SyntheticProject &project,
+                     std::mt19937 &random,
+                     const filesystem::path &dir) {
+    filesystem::create_directories(dir / "include");
+
+    for (size_t level = 0; level < project.includeDepth; ++level) {
+        for (size_t i = 0; i < project.headersPerLevel; ++i) {
+            auto file = std::ofstream{dir / "include" / headerName(level, i)};
+            file << "#pragma once\n\n";
+            writeIncludes(file, project, random, level + 1);
+            file << "\nint h_" << level << "_" << i << "();\n";
+        }
+    }
+}
+
+void generateModules(const SyntheticProject &project,
+                     std::mt19937 &random,
+                     const filesystem::path &dir) {
+    if (!project.numModules) {
+        return;
+    }
+
+    filesystem::create_directories(dir / "src" / "modules");
+
+    for (size_t i = 0; i < project.numModules; ++i) {
+        auto file = std::ofstream{dir / "src" / "modules" /
+                                  (moduleName(i) + ".cppm")};
+        writeIncludes(file, project, random, 0);
+        file << "\nexport module " << moduleName(i) << ";\n\n";
+        for (auto import : moduleImports(project, random, i)) {
+            file << "import " << moduleName(import) << ";\n";
+        }
+        file << "\nexport int " << moduleName(i) << "() {\n"
+             << "    return 0;\n"
+             << "}\n";
+    }
+}
+
+void generateSources(const SyntheticProject &project,
+                     std::mt19937 &random,
+                     const filesystem::path &dir) {
+    auto perLibrary = std::max<size_t>(project.filesPerLibrary, 1);
+
+    for (size_t i = 0; i < project.numFiles; ++i) {
+        auto libraryDir =
+            dir / "src" / ("lib" + std::to_string(i / perLibrary));
+        if (i % perLibrary == 0) {
+            filesystem::create_directories(libraryDir);
+        }
+
+        auto file =
+            std::ofstream{libraryDir / ("f" + std::to_string(i) + ".cpp")};
+        writeIncludes(file, project, random, 0);
+        if (project.numModules) {
+            file << "\nimport " << moduleName(i % project.numModules)
+                 << ";\n";
+        }
+        file << "\nint f" << i << "() {\n"
+             << "    return 0;\n"
+             << "}\n";
+    }
+}
+
+void generateMatmakefile(const SyntheticProject &project,
+                         const filesystem::path &dir) {
+    auto file = std::ofstream{dir / "Matmakefile"};
+
+    file << "# Generated by matmake2-benchmark\n\n";
+
+    auto libraries = std::vector<std::string>{};
+
+    for (size_t i = 0; i < numLibraries(project); ++i) {
+        auto name = "lib" + std::to_string(i);
+        file << name << "\n"
+             << "  out = " << name << "\n"
+             << "  src =\n"
+             << "    src/" << name << "/*.cpp\n"
+             << "  command = [static]\n\n";
+        libraries.push_back(name);
+    }
+
+    if (project.numModules) {
+        file << "modules\n"
+             << "  out = modules\n"
+             << "  src =\n"
+             << "    src/modules/*.cppm\n"
+             << "  command = [static]\n\n";
+        libraries.push_back("modules");
+    }
+
+    file << "main\n"
+         << "  out = main\n"
+         << "  in =\n";
+    for (auto &library : libraries) {
+        file << "    @" << library << "\n";
+    }
+    file << "  command = [exe]\n\n";
+
+    file << "all\n"
+         << "  in = @main\n"
+         << "  includes =\n"
+         << "    include\n";
+}
+
+//! Expand the includes of a file, every file is only included once as if
+//! they all used "#pragma once"
+void expandIncludes(const filesystem::path &path,
+                    const std::vector<filesystem::path> &includeDirs,
+                    std::set<filesystem::path> &included,
+                    std::ostream &out) {
+    auto file = std::ifstream{path};
+    if (!file.is_open()) {
+        throw std::runtime_error{"could not open " + path.string()};
+    }
+
+    constexpr auto includeStatement = std::string_view{"#include \""};
+
+    for (std::string line; getline(file, line);) {
+        if (line.rfind(includeStatement, 0) != 0) {
+            out << line << "\n";
+            continue;
+        }
+
+        auto name = line.substr(includeStatement.size());
+        name = name.substr(0, name.find('"'));
+
+        for (auto &dir : includeDirs) {
+            auto includePath = dir / name;
+            if (!filesystem::exists(includePath)) {
+                continue;
+            }
+            if (included.insert(includePath).second) {
+                out << "# 1 \"" << includePath.string() << "\"\n";
+                expandIncludes(includePath, includeDirs, included, out);
+            }
+            break;
+        }
+    }
+}
+
+} // namespace
+
+ModuleShape toModuleShape(const std::string &str) {
+    if (str == "chain") {
+        return ModuleShape::Chain;
+    }
+    if (str == "tree") {
+        return ModuleShape::Tree;
+    }
+    if (str == "dag") {
+        return ModuleShape::Dag;
+    }
+    throw std::runtime_error{str + " is not a valid module shape: select "
+                                   "chain, tree or dag"};
+}
+
+std::string toString(ModuleShape shape) {
+    switch (shape) {
+    case ModuleShape::Chain:
+        return "chain";
+    case ModuleShape::Tree:
+        return "tree";
+    case ModuleShape::Dag:
+        return "dag";
+    }
+    return {};
+}
+
+std::string syntheticRootName(size_t i) {
+    return "bench" + std::to_string(i);
+}
+
+void generateSyntheticProject(const SyntheticProject &project,
+                              const filesystem::path &dir) {
+    filesystem::create_directories(dir);
+
+    auto random = std::mt19937{project.seed};
+
+    generateHeaders(project, random, dir);
+    generateModules(project, random, dir);
+    generateSources(project, random, dir);
+    generateMatmakefile(project, dir);
+}
+
+Json createStubRoots(const SyntheticProject &project,
+                     const std::string &stubCommand) {
+    auto roots = Json{Json::Array};
+
+    for (size_t i = 0; i < project.numRoots; ++i) {
+        auto name = syntheticRootName(i);
+        auto root = Json{Json::Object};
+        root["name"] = name;
+        root["command"] = "[root]";
+        root["dir"] = "build/" + name;
+        root["objdir"] = "build/.matmake/obj/" + name;
+        root["cxx"] = stubCommand;
+        root["ar"] = stubCommand;
+
+        auto &in = root["in"];
+        in.push_back(Json{"@all"});
+        in.type = Json::Array;
+
+        auto &commands = root["commands"];
+        commands["cxx"] = "{c++} touch {out}";
+        commands["cc"] = "{c++} touch {out}";
+        commands["pcm"] = "{c++} touch {out}";
+        commands["cxxm"] = "{c++} touch {out}";
+        commands["exe"] = "{c++} touch {out}";
+        commands["static"] = "{ar} touch {out}";
+        commands["eem"] = "{c++} eem {in} {out} {includes}";
+
+        roots.push_back(std::move(root));
+    }
+
+    return roots;
+}
+
+int runStubCompiler(const std::vector<std::string> &args) {
+    if (args.size() == 2 && args.at(0) == "touch") {
+        std::ofstream{args.at(1)} << "\n";
+        return 0;
+    }
+
+    if (args.size() >= 3 && args.at(0) == "eem") {
+        auto includeDirs = std::vector<filesystem::path>{};
+        for (size_t i = 3; i < args.size(); ++i) {
+            if (args.at(i).rfind("-I", 0) == 0) {
+                includeDirs.push_back(args.at(i).substr(2));
+            }
+        }
+
+        auto out = std::ofstream{args.at(2)};
+        auto included = std::set<filesystem::path>{};
+        expandIncludes(args.at(1), includeDirs, included, out);
+        return 0;
+    }
+
+    std::cerr << "unknown stub command\n";
+    return 1;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "filesystem.h"
+#include "json/json.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! How the generated modules imports each other
+enum class ModuleShape {
+    Chain, // Every module imports the one before
+    Tree,  // Every module imports its parent in a binary tree
+    Dag,   // Every module imports random modules before it
+};
+
+//! Settings for a generated project. The same settings always gives the same
+//! project
+struct SyntheticProject {
+    size_t numFiles = 1000;
+    size_t filesPerLibrary = 100; // Each library gets its own directory
+    size_t includeDepth = 3;      // Levels of headers
+    size_t headersPerLevel = 50;
+    size_t headerFanIn = 4; // Headers included by each source and header
+    size_t numModules = 0;
+    ModuleShape moduleShape = ModuleShape::Chain;
+    size_t moduleFanIn = 2; // Only used for ModuleShape::Dag
+    size_t numRoots = 1;
+    uint32_t seed = 1;
+};
+
+ModuleShape toModuleShape(const std::string &str);
+
+std::string toString(ModuleShape shape);
+
+//! Name of the root with the index i
+std::string syntheticRootName(size_t i);
+
+//! Write sources, headers and a Matmakefile to the directory
+void generateSyntheticProject(const SyntheticProject &project,
+                              const filesystem::path &dir);
+
+//! Root nodes that builds the project with a stub compiler. They can not be
+//! expressed in a Matmakefile since they need their own commands
+//! @param stubCommand command that starts runStubCompiler()
+Json createStubRoots(const SyntheticProject &project,
+                     const std::string &stubCommand);
+
+//! A fake compiler that is fast enough to not hide the time spent in matmake2
+//!   touch [out]                   create or update the file
+//!   eem [in] [out] [-Idir...]     expand includes and write line markers like
+//!                                 the preprocessor does
+//! @return the exit status
+int runStubCompiler(const std::vector<std::string> &args);
@@ -1,9 +1,14 @@
 //! File used to build faster
 //! Seems to speed up build around 4x
 
+#include "src/buildlog.cpp"
 #include "src/defaultfile.cpp"
+#include "src/depslog.cpp"
 #include "src/exampleproject.cpp"
 #include "src/execute.cpp"
+#include "src/graphcache.cpp"
+#include "src/internedstring.cpp"
+#include "src/jobserver.cpp"
 #include "src/makefile.cpp"
 #include "src/matmakefile.cpp"
 #include "src/msvcenvironment.cpp"
@@ -11,10 +16,15 @@
 #include "src/ninja.cpp"
 #include "src/os.cpp"
 #include "src/parsematmakefile.cpp"
+#include "src/process.cpp"
+#include "src/processedcommand.cpp"
 #include "src/settings.cpp"
+#include "src/statcache.cpp"
 #include "src/task.cpp"
 #include "src/tasklist.cpp"
 #include "src/test.cpp"
+#include "src/trace.cpp"
 #include "src/translateconfig.cpp"
+#include "src/watch.cpp"
 
 #include "src/main/main.cpp"
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+//! Write values to a buffer in the byte order of the machine, used for caches
+//! that is only read by the same build of matmake2 on the same machine
+class BinaryWriter {
+public:
+    template <typename T>
+    void value(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        _buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void string(std::string_view str) {
+        value(static_cast<uint32_t>(str.size()));
+        _buffer.append(str);
+    }
+
+    const std::string &buffer() const {
+        return _buffer;
+    }
+
+private:
+    std::string _buffer;
+};
+
+//! Read values written by BinaryWriter. Throws if the data ends too early,
+//! eg if the file was not completely written
+class BinaryReader {
+public:
+    BinaryReader(std::string_view data)
+        : _data{data} {}
+
+    template <typename T>
+    T value() {
+        static_assert(std::is_trivially_copyable_v<T>);
+        check(sizeof(T));
+        auto value = T{};
+        std::memcpy(&value, _data.data() + _pos, sizeof(T));
+        _pos += sizeof(T);
+        return value;
+    }
+
+    //! The returned string points into the data
+    std::string_view string() {
+        auto size = value<uint32_t>();
+        check(size);
+        auto str = _data.substr(_pos, size);
+        _pos += size;
+        return str;
+    }
+
+    bool atEnd() const {
+        return _pos == _data.size();
+    }
+
+private:
+    void check(size_t size) const {
+        if (size > _data.size() - _pos) {
+            throw std::runtime_error{"unexpected end of binary data"};
+        }
+    }
+
+    std::string_view _data;
+    size_t _pos = 0;
+};
@@ -0,0 +1,297 @@
+#include "buildlog.h"
+#include "hash.h"
+#include <algorithm>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+namespace {
+
+constexpr auto buildLogHeader = std::string_view{"# matmake2 log v3"};
+
+// Records from this many builds is kept when compacting the log
+constexpr size_t maxLoggedBuilds = 20;
+
+// Do not compact small logs
+constexpr size_t minCompactionRecords = 100;
+
+// Compact when there is this many more records than what is kept
+constexpr size_t compactionRatio = 3;
+
+constexpr size_t numPrintedStats = 20;
+
+std::optional<BuildLogRecord> parseRecord(const std::string &line) {
+    auto ss = std::istringstream{line};
+    auto record = BuildLogRecord{};
+    long long start = 0;
+    long long end = 0;
+    std::string hash;
+    std::string outputHash;
+
+    if (!(ss >> record.build >> start >> end >> record.status >> hash >>
+          outputHash)) {
+        return {};
+    }
+
+    ss.get(); // Tab before path
+
+    if (!std::getline(ss, record.out) || record.out.empty()) {
+        return {};
+    }
+
+    record.start = BuildLogRecord::Duration{start};
+    record.end = BuildLogRecord::Duration{end};
+    record.commandHash = hashFromString(hash);
+    record.outputHash = hashFromString(outputHash);
+
+    return record;
+}
+
+void writeRecord(std::ostream &stream, const BuildLogRecord &record) {
+    stream << record.build << "\t" << record.start.count() << "\t"
+           << record.end.count() << "\t" << record.status << "\t"
+           << hashToString(record.commandHash) << "\t"
+           << hashToString(record.outputHash) << "\t" << record.out << "\n";
+}
+
+std::string formatDuration(BuildLogRecord::Duration duration) {
+    auto ss = std::ostringstream{};
+    ss << std::fixed << std::setprecision(3)
+       << static_cast<double>(duration.count()) / 1000. << " s";
+    return ss.str();
+}
+
+} // namespace
+
+BuildLog::BuildLog(filesystem::path path)
+    : _path(std::move(path)) {
+    auto file = std::ifstream{_path};
+
+    if (!file.is_open()) {
+        return;
+    }
+
+    std::string line;
+    if (!std::getline(file, line) || line != buildLogHeader) {
+        return; // Unknown version: start over
+    }
+
+    for (; std::getline(file, line);) {
+        if (auto record = parseRecord(line)) {
+            auto index = _records.size();
+            _latest[record->out] = index;
+            if (record->status == 0) {
+                _latestSuccessful[record->out] = index;
+            }
+            _records.push_back(std::move(*record));
+        }
+    }
+
+    file.close();
+
+    compact();
+}
+
+const BuildLogRecord *BuildLog::latest(const std::string &out) const {
+    if (auto f = _latest.find(out); f != _latest.end()) {
+        return &_records.at(f->second);
+    }
+    return nullptr;
+}
+
+std::optional<BuildLog::Duration> BuildLog::duration(
+    const std::string &out) const {
+    if (auto f = _latestSuccessful.find(out); f != _latestSuccessful.end()) {
+        return _records.at(f->second).duration();
+    }
+    return {};
+}
+
+std::optional<BuildLog::Duration> BuildLog::meanDuration() const {
+    if (_latestSuccessful.empty()) {
+        return {};
+    }
+
+    auto sum = Duration{};
+    for (auto &it : _latestSuccessful) {
+        sum += _records.at(it.second).duration();
+    }
+
+    return sum / _latestSuccessful.size();
+}
+
+void BuildLog::startBuild() {
+    _buildStart = std::chrono::steady_clock::now();
+    _build = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+}
+
+BuildLog::Duration BuildLog::now() const {
+    return std::chrono::duration_cast<Duration>(
+        std::chrono::steady_clock::now() - _buildStart);
+}
+
+void BuildLog::record(BuildLogRecord record) {
+    record.build = _build;
+
+    if (!_path.empty() && !_file.is_open()) {
+        // Called from the worker threads, errors must not throw. The records
+        // is only kept in memory if the file can not be written
+        auto ec = std::error_code{};
+        auto isNew = filesystem::file_size(_path, ec) == 0 || ec;
+        if (_path.has_parent_path()) {
+            filesystem::create_directories(_path.parent_path(), ec);
+        }
+        _file.open(_path, std::ios::app);
+        if (_file.is_open()) {
+            if (isNew) {
+                _file << buildLogHeader << "\n";
+            }
+        }
+        else {
+            _path.clear();
+        }
+    }
+
+    if (_file.is_open()) {
+        writeRecord(_file, record);
+        _file.flush(); // Keep the record even if the build is interrupted
+    }
+
+    auto index = _records.size();
+    _latest[record.out] = index;
+    if (record.status == 0) {
+        _latestSuccessful[record.out] = index;
+    }
+    _records.push_back(std::move(record));
+}
+
+//! Remove records from old builds, but always keep the latest record of each
+//! file
+void BuildLog::compact() {
+    auto builds = std::set<uint64_t>{};
+    for (auto &record : _records) {
+        builds.insert(record.build);
+    }
+
+    while (builds.size() > maxLoggedBuilds) {
+        builds.erase(builds.begin());
+    }
+
+    auto shouldKeep = [&](size_t i) {
+        auto &record = _records.at(i);
+        if (builds.count(record.build)) {
+            return true;
+        }
+        if (_latest.at(record.out) == i) {
+            return true;
+        }
+        if (auto f = _latestSuccessful.find(record.out);
+            f != _latestSuccessful.end() && f->second == i) {
+            return true;
+        }
+        return false;
+    };
+
+    size_t numKept = 0;
+    for (size_t i = 0; i < _records.size(); ++i) {
+        numKept += shouldKeep(i);
+    }
+
+    if (_records.size() < minCompactionRecords ||
+        _records.size() < numKept * compactionRatio) {
+        return;
+    }
+
+    auto records = std::vector<BuildLogRecord>{};
+    records.reserve(numKept);
+    for (size_t i = 0; i < _records.size(); ++i) {
+        if (shouldKeep(i)) {
+            records.push_back(std::move(_records.at(i)));
+        }
+    }
+
+    _records = std::move(records);
+    _latest.clear();
+    _latestSuccessful.clear();
+
+    auto tmpPath = _path;
+    tmpPath += ".tmp";
+
+    {
+        auto file = std::ofstream{tmpPath};
+        if (!file.is_open()) {
+            return;
+        }
+
+        file << buildLogHeader << "\n";
+
+        for (size_t i = 0; i < _records.size(); ++i) {
+            auto &record = _records.at(i);
+            _latest[record.out] = i;
+            if (record.status == 0) {
+                _latestSuccessful[record.out] = i;
+            }
+            writeRecord(file, record);
+        }
+    }
+
+    auto ec = std::error_code{};
+    filesystem::rename(tmpPath, _path, ec);
+    if (ec) {
+        filesystem::remove(tmpPath, ec);
+    }
+}
+
+void BuildLog::printStats(std::ostream &stream, size_t numBuilds) const {
+    auto builds = std::set<uint64_t>{};
+    for (auto &record : _records) {
+        builds.insert(record.build);
+    }
+
+    while (builds.size() > numBuilds) {
+        builds.erase(builds.begin());
+    }
+
+    struct Stat {
+        Duration max = {};
+        Duration sum = {};
+        size_t count = 0;
+        std::string_view out;
+    };
+
+    auto stats = std::map<std::string_view, Stat>{};
+
+    for (auto &record : _records) {
+        if (record.status || !builds.count(record.build)) {
+            continue;
+        }
+        auto &stat = stats[record.out];
+        stat.out = record.out;
+        stat.max = std::max(stat.max, record.duration());
+        stat.sum += record.duration();
+        ++stat.count;
+    }
+
+    auto sorted = std::vector<Stat>{};
+    sorted.reserve(stats.size());
+    for (auto &it : stats) {
+        sorted.push_back(it.second);
+    }
+
+    std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+        return a.max > b.max;
+    });
+
+    stream << "slowest tasks in the last " << builds.size() << " builds:\n";
+    stream << "  max        mean       builds  out\n";
+
+    for (size_t i = 0; i < sorted.size() && i < numPrintedStats; ++i) {
+        auto &stat = sorted.at(i);
+        stream << "  " << std::left << std::setw(11) << formatDuration(stat.max)
+               << std::setw(11) << formatDuration(stat.sum / stat.count)
+               << std::setw(8) << stat.count << stat.out << "\n";
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "filesystem.h"
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+struct BuildLogRecord {
+    using Duration = std::chrono::milliseconds;
+
+    uint64_t build = 0;  // Start time of the build (ms since epoch)
+    Duration start = {}; // Relative to the start of the build
+    Duration end = {};
+    int status = 0; // Exit status of the command
+    uint64_t commandHash = 0;
+    uint64_t outputHash = 0; // Content of the output file, 0 if not hashed
+    std::string out;
+
+    Duration duration() const {
+        return end - start;
+    }
+};
+
+//! Log with one record for each task that is built by the native backend
+//! The log is saved in the intermediate directory of the root target. Records
+//! are appended when the tasks finishes, and old records are removed when the
+//! log is loaded and has grown too large
+class BuildLog {
+public:
+    using Duration = BuildLogRecord::Duration;
+
+    BuildLog() = default;
+
+    //! Load the log from a file, a missing file is treated as an empty log
+    BuildLog(filesystem::path path);
+
+    //! The latest record for a output file
+    const BuildLogRecord *latest(const std::string &out) const;
+
+    //! The duration of the latest successful build of a output file
+    std::optional<Duration> duration(const std::string &out) const;
+
+    //! The mean duration of the latest builds of all files, used for tasks
+    //! that has never been built before
+    std::optional<Duration> meanDuration() const;
+
+    //! Start a new build, the time of each record is relative to this
+    void startBuild();
+
+    //! Time since startBuild()
+    Duration now() const;
+
+    //! Add a record and append it to the log file
+    void record(BuildLogRecord record);
+
+    const std::vector<BuildLogRecord> &records() const {
+        return _records;
+    }
+
+    //! Print the slowest tasks from the last numBuilds builds
+    void printStats(std::ostream &stream, size_t numBuilds) const;
+
+    bool empty() const {
+        return _records.empty();
+    }
+
+private:
+    void compact();
+
+    filesystem::path _path;
+    std::vector<BuildLogRecord> _records;
+    std::map<std::string, size_t> _latest; // Index of latest record
+    std::map<std::string, size_t> _latestSuccessful;
+    std::ofstream _file;
+
+    uint64_t _build = 0;
+    std::chrono::steady_clock::time_point _buildStart;
+};
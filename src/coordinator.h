@@ -1,13 +1,29 @@
 #pragma once
 
+#include "buildlog.h"
+#include "depslog.h"
 #include "filesystem.h"
+#include "hash.h"
+#include "jobserver.h"
 #include "nativecommands.h"
+#include "os.h"
+#include "parsedepfile.h"
+#include "process.h"
 #include "processedcommand.h"
 #include "settings.h"
+#include "statcache.h"
 #include "tasklist.h"
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <queue>
 #include <string>
 #include <thread>
 
@@ -16,11 +32,6 @@
 //! they are done they signal back to the main thread for more work.
 class Coordinator {
 public:
-    enum class RunStatus {
-        Normal,
-        Failed,
-    };
-
     enum class CoordinatorStatus {
         NotStarted,
         Running,
@@ -28,110 +39,390 @@ public:
         Failed,
     };
 
-    RunStatus run(std::string command, bool verbose) {
-        std::cout << command << "\n";
-        std::cout.flush();
-        if (std::system(command.c_str())) {
-            return RunStatus::Failed;
-        }
-        else {
-            return RunStatus::Normal;
-        }
+    //! @param jobServer used to limit the number of processes when running
+    //!        together with other build tools, can be null
+    Coordinator(JobServer *jobServer = nullptr)
+        : _jobServer(jobServer) {}
+
+    //! Run a command and capture its output in a buffer from the pool
+    //! Give back the buffer with returnOutputBuffer() when done
+    ProcessResult run(const std::string &command) {
+        return runProcess(command, takeOutputBuffer(), &_processes);
     }
 
     // Returns true on error
     bool execute(TaskList &tasks, const Settings &settings) {
-        using namespace std::chrono_literals;
+        auto isReady = [](auto &task) {
+            return task->state() == TaskState::DirtyReady;
+        };
+
+        // Do not load the build log on no-op builds
+        if (std::none_of(tasks.begin(), tasks.end(), isReady)) {
+            std::cout << "Nothing to do...\n";
+            return false;
+        }
+
         _status = CoordinatorStatus::Running;
 
+        if (auto root = tasks.findRoot()) {
+            _log = BuildLog{buildLogPath(*root)};
+
+            // Load the deps log here if the state was not calculated, eg when
+            // the graph is read from the cache, to not stall the workers
+            if (!tasks._depsLog) {
+                tasks._depsLog = std::make_unique<DepsLog>(depsLogPath(*root));
+            }
+        }
+
+        _log.startBuild();
+
+        _tasks = &tasks;
+        _graph = createTaskGraph(tasks);
+        _graph.loadState(tasks);
+
+        _levels = sortTasks(tasks);
+        _levelIndex.assign(tasks.size(), 0);
+        for (size_t i = 0; i < _levels.size(); ++i) {
+            for (auto task : _levels[i]) {
+                _levelIndex[task->index()] = i;
+            }
+        }
+        _isUnchanged.assign(tasks.size(), false);
+
+        calculatePriorities(tasks);
+        calculatePools(tasks, settings);
+
+        _shouldRestat = settings.restat;
+        _isTerminal = isTerminal();
+        _maxFailures = settings.maxFailures;
+        _maxLoad = settings.maxLoad;
+        _minMemory = settings.minMemory * 1024 * 1024;
+
         {
             auto lock = std::scoped_lock{_todoMutex};
             for (auto &task : tasks) {
-                auto state = task->state();
+                auto state = this->state(task);
                 if (state == TaskState::DirtyReady) {
-                    _todo.push_back(task.get());
+                    _todo.push(queueEntry(task));
                     ++_numTasks;
                 }
                 else if (state == TaskState::DirtyWaiting) {
                     ++_numTasks;
                 }
+                else {
+                    continue;
+                }
+
+                if (!task->out().empty()) {
+                    ++_numCommands;
+                }
             }
         }
 
         createDirectories(tasks);
 
-        if (_todo.empty()) {
-            std::cout << "Nothing to do...\n";
-            return false;
-        }
-
         if (settings.numThreads == 0) {
             throw std::runtime_error{"numThreads == 0"};
         }
 
+        // Handle ctrl-c on a separate thread, started threads inherits the
+        // blocked signals
+        blockInterrupts();
+        auto signalThread = std::thread{[this] { handleInterrupts(); }};
+
         workers.reserve(settings.numThreads);
         for (size_t i = 0; i < settings.numThreads; ++i) {
             workers.emplace_back(
                 [this, i, &settings] { workerThread(i, settings); });
         }
 
-        while (_status == CoordinatorStatus::Running) {
-            if (_finished.empty()) {
-                std::this_thread::sleep_for(10ms);
+        while (auto finishedTask = popFinished()) {
+            if (state(finishedTask) == TaskState::Failed) {
+                failSubscribers(finishedTask);
             }
             else {
-                auto lock = std::scoped_lock{_subscriberMutex};
-                auto finishedTask = _finished.front();
-                for (auto task : finishedTask->subscribers()) {
-                    if (task->state() == TaskState::DirtyWaiting) {
-                        task->subscribtionNotice(finishedTask);
-                        if (task->state() == TaskState::DirtyReady) {
-                            pushTask(task);
-                        }
+                for (auto index : _graph.subscribers(finishedTask->index())) {
+                    auto &state = _graph.states[index];
+                    if (state != TaskState::DirtyWaiting ||
+                        --_graph.numPending[index]) {
+                        continue;
                     }
-                }
-                _finished.erase(_finished.begin(), _finished.begin() + 1);
+                    state = TaskState::DirtyReady;
 
-                ++_numFinished;
-                if (_numFinished >= _numTasks) {
-                    _status = CoordinatorStatus::Done;
+                    auto task = _tasks->_tasks[index];
+                    if (_shouldRestat && canSkip(task)) {
+                        skipTask(task);
+                    }
+                    else {
+                        pushTask(task);
+                    }
                 }
             }
+
+            ++_numFinished;
+            if (_numFinished >= _numTasks) {
+                status(CoordinatorStatus::Done);
+            }
+        }
+
+        if (_status == CoordinatorStatus::Failed) {
+            // Do not wait for running commands that is not needed anymore
+            _processes.stop(gracePeriod);
         }
 
         for (auto &worker : workers) {
             worker.join();
         }
 
-        return _status != CoordinatorStatus::Done;
+        // The state is used to calculate what to build next time when the
+        // task list is kept in memory
+        for (auto task : tasks) {
+            task->setState(state(task));
+        }
+
+        _isSignalThreadDone = true;
+        signalThread.join();
+        unblockInterrupts();
+
+        if (_isStatusLineVisible) {
+            std::cout << "\n";
+        }
+
+        if (_isInterrupted) {
+            std::cout << "interrupted\n";
+        }
+
+        printFailures();
+
+        return _status != CoordinatorStatus::Done || !_failedTasks.empty();
     }
 
-    //! Runs in worker thread (obviously)
-    void workerThread(size_t i, const Settings &settings) {
+    //! Stops the build when the user presses ctrl-c or the process is
+    //! terminated. The main thread takes care of stopping running commands
+    void handleInterrupts() {
         using namespace std::chrono_literals;
 
-        if (settings.debugPrint) {
-            std::cout << ("starting thread " + std::to_string(i) + "\n");
+        while (!_isSignalThreadDone) {
+            if (waitForInterrupt(100ms)) {
+                _isInterrupted = true;
+                status(CoordinatorStatus::Failed);
+            }
         }
-        while (_status == CoordinatorStatus::Running) {
-            if (auto task = popTask()) {
-                auto out = task->out();
-                if (out.empty()) {
-                    if (settings.debugPrint) {
-                        std::cout << " do not build task " << task->name()
-                                  << " because no output files is "
-                                     "specified\n";
-                    }
-                    pushFinished(task, settings.verbose);
+    }
+
+    //! With restat a task does not need to be built if all inputs that was
+    //! rebuilt got the same content as before, and it was up to date with
+    //! all its inputs before the build started
+    //! Runs on main thread
+    bool canSkip(Task *task) {
+        if (task->isCommandChanged()) {
+            return false;
+        }
+
+        auto out = task->out();
+        if (!out.empty() && !task->exists()) {
+            return false;
+        }
+
+        bool hasUnchangedInput = false;
+        for (auto in : task->in()) {
+            if (isUnchanged(in)) {
+                hasUnchangedInput = true;
+            }
+            else if (isDirty(in) || state(in) == TaskState::Done) {
+                return false; // Rebuilt with new content
+            }
+
+            // changedTime() is cached from before the build
+            if (!out.empty() && in->changedTime() >= task->changedTime()) {
+                return false;
+            }
+        }
+
+        return hasUnchangedInput;
+    }
+
+    //! Mark a task as done without building it
+    //! The output is touched so that it is newer than its rebuilt inputs on
+    //! the next build
+    //! Runs on main thread
+    void skipTask(Task *task) {
+        if (auto out = task->out(); !out.empty()) {
+            auto ec = std::error_code{};
+            filesystem::last_write_time(
+                out, filesystem::file_time_type::clock::now(), ec);
+            statCache().invalidate(out);
+
+            auto lock = std::scoped_lock{_outputMutex};
+            --_numCommands;
+        }
+
+        {
+            auto lock = std::scoped_lock{_finishedMutex};
+            _isUnchanged[task->index()] = true;
+        }
+
+        state(task, TaskState::Done);
+        pushFinished(task);
+    }
+
+    bool isUnchanged(const Task *task) {
+        if (!_tasks->contains(task)) {
+            return false;
+        }
+        auto lock = std::scoped_lock{_finishedMutex};
+        return _isUnchanged[task->index()];
+    }
+
+    //! Tasks that depends on a failed task can not be built, mark them as
+    //! failed so that independent tasks can continue to be built
+    //! The subscribers is always on later levels, so the failure spreads in
+    //! one pass from the level of the failed task
+    //! Runs on main thread
+    void failSubscribers(Task *failedTask) {
+        for (auto i = _levelIndex[failedTask->index()]; i < _levels.size();
+             ++i) {
+            for (auto task : _levels[i]) {
+                if (state(task) != TaskState::Failed) {
                     continue;
                 }
+                for (auto index : _graph.subscribers(task->index())) {
+                    auto &state = _graph.states[index];
+                    if (state == TaskState::DirtyWaiting) {
+                        state = TaskState::Failed;
+                        ++_numFinished;
+                        ++_numSkipped;
 
-                buildTask(task, settings);
+                        // Keep the progress total right, as in skipTask()
+                        if (!_tasks->_tasks[index]->out().empty()) {
+                            auto lock = std::scoped_lock{_outputMutex};
+                            --_numCommands;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void printFailures() {
+        if (_failedTasks.empty()) {
+            return;
+        }
+
+        std::cout << "\nfailed tasks:\n";
+        for (auto task : _failedTasks) {
+            std::cout << "  " << task->name() << "\n";
+        }
+
+        if (_numSkipped) {
+            std::cout << _numSkipped
+                      << " tasks that depends on failed tasks was not built\n";
+        }
+
+        std::cout.flush();
+    }
+
+    //! Pools limits how many tasks of a kind that can run at the same time
+    //! Linking and precompiling modules uses a lot of memory and is limited to
+    //! half the number of threads by default. Other sizes can be specified
+    //! with the "pools" property in the Matmakefile, a size of 0 means no
+    //! limit
+    void calculatePools(TaskList &tasks, const Settings &settings) {
+        auto defaultSize = std::max<size_t>(settings.numThreads / 2, 1);
+
+        _poolSizes = {
+            {"link", defaultSize},
+            {"pcm", defaultSize},
+        };
+
+        for (auto &task : tasks) {
+            for (auto &pool : task->pools()) {
+                _poolSizes[pool.first] = pool.second;
+            }
+        }
+    }
+
+    //! Calculate the length of the longest path from each dirty task to the
+    //! root, tasks on the critical path are started first
+    //! The weight of each task is the time it took on the last build, or the
+    //! mean of all known build times for new tasks. If there is no history
+    //! at all every task counts as one step, which makes the priority the
+    //! depth of the task
+    //! The levels is calculated in reverse so that the priorities of the
+    //! subscribers is known before the tasks they depends on
+    void calculatePriorities(TaskList &tasks) {
+        _graph.priorities.assign(tasks.size(), 0.);
+
+        auto defaultWeight = 1.;
+        if (auto mean = _log.meanDuration()) {
+            defaultWeight = static_cast<double>(mean->count());
+        }
+
+        for (auto level = _levels.rbegin(); level != _levels.rend(); ++level) {
+            for (auto task : *level) {
+                if (isDirty(task)) {
+                    _graph.priorities[task->index()] =
+                        calculatePriority(task, defaultWeight);
+                }
+            }
+        }
+    }
+
+    double calculatePriority(Task *task, double defaultWeight) {
+        auto longest = 0.;
+        for (auto index : _graph.subscribers(task->index())) {
+            if (::isDirty(_graph.states[index])) {
+                longest = std::max(longest, _graph.priorities[index]);
+            }
+        }
+
+        auto weight = 0.;
+        if (auto out = task->out(); !out.empty()) {
+            if (auto duration = _log.duration(out.string())) {
+                weight = static_cast<double>(duration->count());
             }
             else {
-                std::this_thread::sleep_for(10ms);
+                weight = defaultWeight;
             }
         }
+
+        return weight + longest;
+    }
+
+    //! Runs in worker thread (obviously)
+    void workerThread(size_t i, const Settings &settings) {
+        if (settings.debugPrint) {
+            std::cout << ("starting thread " + std::to_string(i) + "\n");
+        }
+        while (auto task = popTask()) {
+            auto out = task->out();
+            if (out.empty()) {
+                if (settings.debugPrint) {
+                    std::cout << " do not build task " << task->name()
+                              << " because no output files is "
+                                 "specified\n";
+                }
+                state(task, TaskState::Done);
+                pushFinished(task);
+                releaseTask(task);
+                continue;
+            }
+
+            {
+                // Do not create the strings for the span when not tracing
+                auto span = std::optional<TraceScope>{};
+                if (trace()) {
+                    auto category = task->commandName();
+                    // Track 0 is the main thread
+                    span.emplace(task->name(),
+                                 category.empty() ? "custom" : category,
+                                 i + 1,
+                                 out.string());
+                }
+                buildTask(task, settings);
+            }
+            releaseTask(task);
+        }
     }
 
     //! Runs on worker thread
@@ -139,11 +430,35 @@ public:
         auto rawCommand = task->command();
 
         if (auto f = native::findCommand(rawCommand)) {
-            if (f(*task) == native::CommandStatus::Failed) {
-                _status = CoordinatorStatus::Failed;
+            auto command = "[" + rawCommand + "] " + task->out().string();
+
+            auto record = BuildLogRecord{};
+            record.start = _log.now();
+
+            auto result = ProcessResult{};
+            result.status = (f(*task) == native::CommandStatus::Failed);
+
+            record.end = _log.now();
+            statCache().invalidate(task->out());
+
+            // Logged so that the time of eg copying is known by --stats and
+            // when calculating priorities
+            record.status = result.status;
+            record.commandHash = fnv1a(command);
+            record.out = task->out().string();
+            {
+                auto lock = std::scoped_lock{_logMutex};
+                _log.record(std::move(record));
+            }
+
+            printResult(*task, command, result, settings.verbose);
+
+            if (result.status) {
+                failTask(task);
             }
             else {
-                pushFinished(task, settings.verbose);
+                state(task, TaskState::Done);
+                pushFinished(task);
             }
         }
         else if (rawCommand.empty() || rawCommand.front() == '[') {
@@ -151,61 +466,493 @@ public:
                                      " on target " + task->name()};
         }
         else {
-            auto command = ProcessedCommand{rawCommand}.expand(*task);
+            auto command = ProcessedCommand::cached(rawCommand).expand(*task);
 
             if (!command.empty()) {
-                if (run(command, settings.verbose) == RunStatus::Failed) {
-                    _status = CoordinatorStatus::Failed;
+                if (!acquireJobSlot()) {
+                    return;
+                }
+
+                auto record = BuildLogRecord{};
+                record.start = _log.now();
+
+                auto result = run(command);
+
+                record.end = _log.now();
+                releaseJobSlot();
+                statCache().invalidate(task->out());
+
+                if (result.status) {
+                    // Half written files should not look up to date on the
+                    // next build
+                    auto ec = std::error_code{};
+                    filesystem::remove(task->out(), ec);
+
+                    if (_status != CoordinatorStatus::Running) {
+                        // Stopped by the coordinator, not a real failure
+                        returnOutputBuffer(std::move(result.output));
+                        return;
+                    }
+                }
+
+                record.status = result.status;
+                record.commandHash = fnv1a(command);
+                record.out = task->out().string();
+
+                if (_shouldRestat && !result.status) {
+                    if (auto hash = hashFile(task->out())) {
+                        record.outputHash = *hash;
+                    }
+                }
+
+                bool isUnchanged = false;
+                {
+                    auto lock = std::scoped_lock{_logMutex};
+                    if (auto previous = _log.latest(record.out)) {
+                        isUnchanged = record.outputHash &&
+                                      previous->status == 0 &&
+                                      previous->outputHash == record.outputHash;
+                    }
+                    _log.record(std::move(record));
+                }
+
+                if (isUnchanged) {
+                    auto lock = std::scoped_lock{_finishedMutex};
+                    _isUnchanged[task->index()] = true;
+                }
+
+                printResult(*task, command, result, settings.verbose);
+                returnOutputBuffer(std::move(result.output));
+
+                if (result.status) {
+                    failTask(task);
                 }
                 else {
-                    task->setState(TaskState::Done);
-                    pushFinished(task, settings.verbose);
+                    recordDeps(*task);
+                    state(task, TaskState::Done);
+                    pushFinished(task);
                 }
             }
         }
     }
 
+    //! Save the dependencies from the depfile of a task that was just built
+    //! so that the depfile does not need to be parsed on the next build
+    //! Runs on worker thread
+    void recordDeps(Task &task) {
+        auto depfile = task.depfile();
+        if (depfile.empty()) {
+            return;
+        }
+
+        auto content = DepFileContent{};
+        if (!parseDepFile(depfile, content) || content.deps.empty()) {
+            return;
+        }
+
+        auto out = task.out();
+        auto stat = statCache().stat(out);
+        if (!stat.exists) {
+            return;
+        }
+
+        auto &depsLog = _tasks->_depsLog;
+        if (!depsLog) {
+            return;
+        }
+
+        auto lock = std::scoped_lock{_logMutex};
+        depsLog->record(
+            out.string(), DepsLog::toMtime(stat.mtime), content.deps);
+    }
+
+    //! Print the result of a task in one piece so that the output of
+    //! different tasks never is mixed up
+    //! Commands is only printed in verbose mode or if there is any output to
+    //! explain. On terminals the status line is replaced by the next one
+    void printResult(const Task &task,
+                     const std::string &command,
+                     const ProcessResult &result,
+                     bool verbose) {
+        constexpr size_t maxStatusWidth = 79;
+
+        auto lock = std::scoped_lock{_outputMutex};
+
+        ++_numPrinted;
+
+        auto &text = _printBuffer;
+        text.clear();
+
+        if (_isStatusLineVisible) {
+            text += "\r\x1b[K";
+        }
+
+        if (result.status) {
+            text += "FAILED: " + task.name() + "\n";
+        }
+
+        if (verbose || result.status || !result.output.empty()) {
+            text += command;
+            text += "\n";
+            text += result.output;
+            if (!result.output.empty() && result.output.back() != '\n') {
+                text += "\n";
+            }
+        }
+
+        auto status = "[" + std::to_string(_numPrinted) + "/" +
+                      std::to_string(_numCommands) + "] ";
+        auto name = task.name();
+        if (_isTerminal && status.size() + name.size() > maxStatusWidth) {
+            auto keep = maxStatusWidth - std::min(maxStatusWidth,
+                                                  status.size() + 3);
+            name = "..." + name.substr(name.size() - keep);
+        }
+
+        text += status;
+        text += name;
+
+        if (_isTerminal) {
+            _isStatusLineVisible = true;
+        }
+        else {
+            text += "\n";
+        }
+
+        std::cout << text;
+        std::cout.flush();
+    }
+
+    std::string takeOutputBuffer() {
+        auto lock = std::scoped_lock{_outputMutex};
+
+        if (_outputBuffers.empty()) {
+            return {};
+        }
+
+        auto buffer = std::move(_outputBuffers.back());
+        _outputBuffers.pop_back();
+        return buffer;
+    }
+
+    void returnOutputBuffer(std::string buffer) {
+        // Do not keep huge buffers alive
+        constexpr size_t maxBufferSize = 1024 * 1024;
+
+        if (buffer.capacity() > maxBufferSize) {
+            return;
+        }
+
+        auto lock = std::scoped_lock{_outputMutex};
+        _outputBuffers.push_back(std::move(buffer));
+    }
+
+    //! Wait for a free slot from the jobserver before starting a process
+    //! @return false if the build was stopped while waiting
+    bool acquireJobSlot() {
+        using namespace std::chrono_literals;
+
+        if (!_jobServer) {
+            return true;
+        }
+
+        while (!_jobServer->acquire(100ms)) {
+            if (_status != CoordinatorStatus::Running) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void releaseJobSlot() {
+        if (_jobServer) {
+            _jobServer->release();
+        }
+    }
+
     //! Get a new task for the worker
+    //! The task with the longest remaining path to the root is selected first
+    //! Tasks whose pool is full is skipped, and no new tasks is started while
+    //! the machine is overloaded, as long as something else is running
+    //! Blocks until there is work to do, returns nullptr when the build is
+    //! finished or failed
     [[nodiscard]] Task *popTask() {
-        auto lock = std::scoped_lock{_todoMutex};
+        using namespace std::chrono_literals;
 
-        if (_todo.empty()) {
-            return nullptr;
+        auto lock = std::unique_lock{_todoMutex};
+
+        for (;;) {
+            if (_status != CoordinatorStatus::Running) {
+                return nullptr;
+            }
+
+            bool isBusy = isMachineBusy();
+
+            if (!_todo.empty() && !isBusy) {
+                if (auto task = popAvailableTask()) {
+                    ++_numRunning;
+                    return task;
+                }
+            }
+
+            if (isBusy) {
+                // Check load again later
+                _todoCondition.wait_for(lock, 100ms);
+            }
+            else {
+                _todoCondition.wait(lock);
+            }
         }
-        else {
-            auto task = _todo.front();
-            _todo.erase(_todo.begin(), _todo.begin() + 1);
-            return task;
+    }
+
+    //! Let the scheduler know that the worker is done with the task
+    void releaseTask(Task *task) {
+        bool isRequeued = false;
+        {
+            auto lock = std::scoped_lock{_todoMutex};
+            --_numRunning;
+            if (auto f = _poolUsage.find(task->pool()); f != _poolUsage.end()) {
+                --f->second;
+
+                // One slot is free, so one task waiting for the pool can run
+                auto &blocked = _blocked[task->pool()];
+                if (!blocked.empty()) {
+                    _todo.push(blocked.top());
+                    blocked.pop();
+                    isRequeued = true;
+                }
+            }
+        }
+        if (isRequeued) {
+            _todoCondition.notify_one();
         }
     }
 
     //! Add a task to the que to be worked on asap
     void pushTask(Task *task) {
-        auto lock = std::scoped_lock{_todoMutex};
-        _todo.push_back(task);
+        {
+            auto lock = std::scoped_lock{_todoMutex};
+            _todo.push(queueEntry(task));
+        }
+        _todoCondition.notify_one();
+    }
+
+    void pushFinished(Task *task) {
+        {
+            auto lock = std::scoped_lock{_finishedMutex};
+            _finished.push(task);
+        }
+        _finishedCondition.notify_one();
+    }
+
+    //! Stop the build when too many tasks has failed, otherwise continue
+    //! building tasks that does not depend on the failed task
+    void failTask(Task *task) {
+        state(task, TaskState::Failed);
+
+        bool shouldStop = false;
+        {
+            auto lock = std::scoped_lock{_finishedMutex};
+            _failedTasks.push_back(task);
+            shouldStop = _maxFailures && _failedTasks.size() >= _maxFailures;
+        }
+
+        if (shouldStop) {
+            status(CoordinatorStatus::Failed);
+        }
+        else {
+            pushFinished(task);
+        }
     }
 
-    void pushFinished(Task *task, bool verbose) {
-        auto lock = std::scoped_lock{_subscriberMutex};
+    //! Wait for the next finished task on the main thread
+    //! Returns nullptr when the build is finished or failed
+    [[nodiscard]] Task *popFinished() {
+        auto lock = std::unique_lock{_finishedMutex};
+
+        _finishedCondition.wait(lock, [this] {
+            return !_finished.empty() || _status != CoordinatorStatus::Running;
+        });
 
-        if (verbose) {
-            std::cout << "task " + task->name() + " finished";
-            std::cout.flush();
+        if (_status != CoordinatorStatus::Running) {
+            return nullptr;
         }
-        _finished.push_back(task);
+
+        auto task = _finished.front();
+        _finished.pop();
+        return task;
+    }
+
+    //! Change status and wake up all threads waiting for work
+    void status(CoordinatorStatus value) {
+        {
+            auto lock = std::scoped_lock{_todoMutex, _finishedMutex};
+            _status = value;
+        }
+        _todoCondition.notify_all();
+        _finishedCondition.notify_all();
     }
 
 private:
+    struct QueuedTask {
+        double priority = 0;
+        size_t fanOut = 0;
+        size_t order = 0;
+        Task *task = nullptr;
+        std::string pool;
+
+        //! Ordering used by the priority queue, the largest value is
+        //! popped first
+        bool operator<(const QueuedTask &other) const {
+            if (priority != other.priority) {
+                return priority < other.priority;
+            }
+            if (fanOut != other.fanOut) {
+                return fanOut < other.fanOut;
+            }
+            return order > other.order; // First in first out
+        }
+    };
+
+    //! Must be called with _todoMutex locked
+    QueuedTask queueEntry(Task *task) {
+        auto index = task->index();
+        return {
+            std::max(_graph.priorities.at(index), 0.),
+            _graph.subscribers(index).size(),
+            _numQueued++,
+            task,
+            task->pool(),
+        };
+    }
+
+    //! Pop the task with highest priority that is not limited by its pool
+    //! Tasks whose pool is full is moved to _blocked, and is queued again by
+    //! releaseTask() when the pool has a free slot
+    //! Must be called with _todoMutex locked
+    Task *popAvailableTask() {
+        while (!_todo.empty()) {
+            auto entry = _todo.top();
+            _todo.pop();
+
+            auto size = _poolSizes.find(entry.pool);
+            if (size == _poolSizes.end() || size->second == 0) {
+                return entry.task;
+            }
+
+            auto &usage = _poolUsage[entry.pool];
+            if (usage < size->second) {
+                ++usage;
+                return entry.task;
+            }
+
+            _blocked[entry.pool].push(std::move(entry));
+        }
+
+        return nullptr;
+    }
+
+    //! Check if the load average or memory usage is too high to start more
+    //! tasks. Something is always allowed to run to prevent deadlocks
+    //! Must be called with _todoMutex locked
+    bool isMachineBusy() {
+        if (_numRunning == 0) {
+            return false;
+        }
+
+        if (_maxLoad > 0) {
+            if (auto load = loadAverage(); load && *load >= _maxLoad) {
+                return true;
+            }
+        }
+
+        if (_minMemory > 0) {
+            if (auto memory = availableMemory(); memory && *memory < _minMemory) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //! The state of a task during the build, tasks outside of the list keeps
+    //! the state they got when it was calculated
+    TaskState state(const Task *task) {
+        if (!_tasks->contains(task)) {
+            return task->state();
+        }
+        return _graph.states[task->index()];
+    }
+
+    //! Every task is only changed by one thread at a time
+    void state(const Task *task, TaskState value) {
+        _graph.states[task->index()] = value;
+    }
+
+    bool isDirty(const Task *task) {
+        return ::isDirty(state(task));
+    }
+
+    JobServer *_jobServer = nullptr;
+
+    // Running commands is stopped with SIGTERM, and SIGKILL if they do not
+    // stop within the grace period
+    static constexpr auto gracePeriod = std::chrono::seconds{2};
+    ProcessGroups _processes;
+    std::atomic_bool _isSignalThreadDone = false;
+    std::atomic_bool _isInterrupted = false;
+
     std::vector<std::thread> workers;
-    CoordinatorStatus _status = CoordinatorStatus::NotStarted;
+    std::atomic<CoordinatorStatus> _status = CoordinatorStatus::NotStarted;
+
+    // The graph and the scheduling state of each task is indexed by
+    // Task::index() instead of looked up in maps
+    TaskList *_tasks = nullptr;
+    TaskGraph _graph;
+    std::vector<std::vector<Task *>> _levels; // From sortTasks()
+    std::vector<size_t> _levelIndex; // The level of each task
+    std::mutex _logMutex;
+    BuildLog _log;
 
     // Give the threads something to do
     std::mutex _todoMutex;
-    std::vector<Task *> _todo;
+    std::condition_variable _todoCondition;
+    std::priority_queue<QueuedTask> _todo;
+    size_t _numQueued = 0;
+    size_t _numRunning = 0;
+
+    // Limits the number of tasks of the same kind
+    std::map<std::string, size_t> _poolSizes;
+    std::map<std::string, size_t> _poolUsage;
+    std::map<std::string, std::priority_queue<QueuedTask>> _blocked;
+
+    // Limits when the machine is overloaded
+    double _maxLoad = 0;
+    size_t _minMemory = 0; // In bytes
 
     // Handle when tasks are finished
-    size_t _numTasks;
-    size_t _numFinished;
-    std::mutex _subscriberMutex;
-    std::vector<Task *> _finished;
+    size_t _numTasks = 0;
+    size_t _numFinished = 0;
+    std::mutex _finishedMutex;
+    std::condition_variable _finishedCondition;
+    std::queue<Task *> _finished;
+
+    // Output from tasks
+    std::mutex _outputMutex;
+    std::vector<std::string> _outputBuffers; // Reused for captured output
+    std::string _printBuffer;
+    bool _isTerminal = false;
+    bool _isStatusLineVisible = false;
+    size_t _numCommands = 0; // Number of tasks that produces output files
+    size_t _numPrinted = 0;
+
+    // Tasks whose output had the same content as before they was built
+    bool _shouldRestat = false;
+    std::vector<bool> _isUnchanged; // Protected by _finishedMutex
+
+    // Keep going until this many tasks has failed, 0 means no limit
+    size_t _maxFailures = 1;
+    std::vector<Task *> _failedTasks;
+    size_t _numSkipped = 0; // Not built because a dependency failed
 };
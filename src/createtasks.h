@@ -1,22 +1,48 @@
 #pragma once
 
+#include "graphcache.h"
 #include "matmakefile.h"
 #include "prescan.h"
 #include "sourcetype.h"
 #include "task.h"
 #include "tasklist.h"
+#include "trace.h"
 #include "translateconfig.h"
+#include <map>
 #include <memory>
+#include <sstream>
+#include <unordered_map>
 
 namespace task {
 
-inline std::vector<filesystem::path> expandPaths(filesystem::path expression) {
+//! Tasks that is already created, so that files and targets that is used by
+//! many targets is only created once
+struct CreatedTasks {
+    std::map<filesystem::path, Task *> files;        // By output path
+    std::unordered_map<std::string, Task *> targets; // By node name
+
+    // Directories and files that was searched for source files, the tasks
+    // needs to be created again when files is added or removed in them
+    std::vector<filesystem::path> searchedPaths;
+
+    //! Remember a path before it is searched, so that files that is added
+    //! while searching makes the saved task graph out of date
+    void search(filesystem::path path) {
+        statCache().stat(path);
+        searchedPaths.push_back(std::move(path));
+    }
+};
+
+inline std::vector<filesystem::path> expandPaths(filesystem::path expression,
+                                                 CreatedTasks &created) {
     auto filename = expression.filename().string();
     if (auto f = filename.find('*'); f != std::string::npos) {
         auto dir = expression.parent_path();
         auto beginning = filename.substr(0, f);
         auto ending = filename.substr(f + 1);
 
+        created.search("." / dir);
+
         auto ret = std::vector<filesystem::path>{};
         for (auto it : filesystem::directory_iterator{"." / dir}) {
             if (it.path() == "." || it.path() == "..") {
@@ -54,16 +80,17 @@ inline std::vector<filesystem::path> expandPaths(filesystem::path expression) {
     return {expression};
 }
 
-//! The last item is the one that is expected to be linked to
-inline TaskList createTaskFromPath(filesystem::path path,
-                                   FlagStyle style,
-                                   bool useModules = true) {
-    auto ret = TaskList{};
-
+//! Create the tasks for a source file in ret
+//! @return the task that is expected to be linked to, nullptr if no task was
+//!         created
+inline Task *createTaskFromPath(filesystem::path path,
+                                FlagStyle style,
+                                TaskList &ret,
+                                bool useModules = true) {
     auto type = SourceType{};
 
     if (path.empty()) {
-        return {};
+        return nullptr;
     }
 
     try {
@@ -146,13 +173,37 @@ inline TaskList createTaskFromPath(filesystem::path path,
         }
     }
 
-    return ret;
+    return &ret.back();
 }
 
-//! Create a task to copy a single file
-inline TaskList createCopyTaskFromPath(std::string pattern) {
-    TaskList ret;
+//! Parse pool declarations like "link 2" or "link:2"
+inline std::map<std::string, size_t> parsePools(const Property &property) {
+    auto pools = std::map<std::string, size_t>{};
+
+    for (auto &value : property.values) {
+        auto f = value.find_first_of(" :");
+        if (f == std::string::npos) {
+            throw std::runtime_error{"expected pool size for '" + value +
+                                     "' at " + std::string{property.pos}};
+        }
+
+        auto ss = std::istringstream{value.substr(f + 1)};
+        size_t size = 0;
+        if (!(ss >> size)) {
+            throw std::runtime_error{"could not parse pool size '" + value +
+                                     "' at " + std::string{property.pos}};
+        }
+
+        pools[value.substr(0, f)] = size;
+    }
+
+    return pools;
+}
 
+//! Create tasks to copy the files matching the pattern in ret
+inline void createCopyTaskFromPath(std::string pattern,
+                                   CreatedTasks &created,
+                                   TaskList &ret) {
     auto createCopyTask = [&ret](filesystem::path path) {
         auto &source = ret.emplace();
 
@@ -166,10 +217,16 @@ inline TaskList createCopyTaskFromPath(std::string pattern) {
         task.command("[copy]");
     };
 
+    // The file can be removed or replaced with a directory
+    created.search(pattern);
+
     if (filesystem::exists(pattern)) {
         if (filesystem::is_directory(pattern)) {
             for (auto &it : filesystem::recursive_directory_iterator{pattern}) {
-                if (!filesystem::is_directory(it.path())) {
+                if (filesystem::is_directory(it.path())) {
+                    created.search(it.path());
+                }
+                else {
                     createCopyTask(it.path());
                 }
             }
@@ -179,87 +236,88 @@ inline TaskList createCopyTaskFromPath(std::string pattern) {
         }
     }
     else {
-        for (auto path : expandPaths(pattern)) {
+        for (auto path : expandPaths(pattern, created)) {
             createCopyTask(pattern);
         }
     }
-
-    return ret;
 }
 
-inline std::pair<TaskList, Task *> createTree(
-    const MatmakeFile &file,
-    const MatmakeNode &root,
-    std::map<filesystem::path, Task *> &duplicateMap,
-    FlagStyle style) {
-    TaskList taskList;
+//! Set the properties of a node that does not depend on other nodes or files
+inline void setNodeProperties(const MatmakeNode &node, Task &task) {
+    task.name(node.name());
 
-    if (auto f = std::find_if(duplicateMap.begin(),
-                              duplicateMap.end(),
-                              [name = root.name()](auto &&it) {
-                                  return it.second->name() == name;
-                              });
-        f != duplicateMap.end()) {
-        return {TaskList{}, f->second};
-    }
-
-    auto &task = taskList.emplace();
-
-    task.name(root.name());
-
-    if (auto p = root.property("flagstyle")) {
+    if (auto p = node.property("flagstyle")) {
         // Needs to be first
         task.flagStyle(p->value());
-
-        style = task.flagStyle();
     }
-    if (auto p = root.property("dir")) {
+    if (auto p = node.property("dir")) {
         task.dir(BuildLocation::Real, p->value());
     }
-    if (auto p = root.property("objdir")) {
+    if (auto p = node.property("objdir")) {
         task.dir(BuildLocation::Intermediate, p->value());
     }
-    if (auto p = root.property("cxx")) {
+    if (auto p = node.property("cxx")) {
         task.cxx(p->value());
     }
-    if (auto p = root.property("cc")) {
+    if (auto p = node.property("cc")) {
         task.cc(p->value());
     }
-    if (auto p = root.property("ar")) {
+    if (auto p = node.property("ar")) {
         task.ar(p->value());
     }
-    if (auto p = root.property("command")) {
+    if (auto p = node.property("command")) {
         task.command(p->value());
     }
+}
+
+//! Create the tasks for a node and the nodes and files that it depends on in
+//! taskList. All tasks is created directly in the final list
+//! @return the task created for the node
+inline Task *createTree(const MatmakeFile &file,
+                        const MatmakeNode &root,
+                        CreatedTasks &created,
+                        FlagStyle style,
+                        TaskList &taskList) {
+    if (auto f = created.targets.find(std::string{root.name()});
+        f != created.targets.end()) {
+        return f->second;
+    }
+
+    auto &task = taskList.emplace();
+
+    setNodeProperties(root, task);
+
+    if (root.property("flagstyle")) {
+        style = task.flagStyle();
+    }
     if (auto p = root.property("src")) {
         // Requires command to be red before becauso of flag style
         for (auto &src : p->values) {
-            auto paths = expandPaths(src);
+            auto paths = expandPaths(src, created);
 
             for (auto &path : paths) {
-                if (auto f = duplicateMap.find(path); f != duplicateMap.end()) {
+                if (auto f = created.files.find(path);
+                    f != created.files.end()) {
                     task.pushIn(f->second);
                 }
-                else {
-                    auto list = createTaskFromPath(path, style);
-                    if (!list.empty()) {
-                        task.pushIn(&list.back());
-                        duplicateMap[path] = &list.back();
-                        taskList.insert(std::move(list));
-                    }
+                else if (auto linked =
+                             createTaskFromPath(path, style, taskList)) {
+                    task.pushIn(linked);
+                    created.files[path] = linked;
                 }
             }
         }
     }
     if (auto p = root.property("copy")) {
         for (auto &c : p->values) {
-            auto list = createCopyTaskFromPath(c);
-            for (auto &copyTask : list) {
-                if (copyTask->command() == "copy") {
-                    task.pushIn(copyTask.get());
+            auto first = taskList.size();
+            createCopyTaskFromPath(c, created, taskList);
+            for (auto i = first; i < taskList.size(); ++i) {
+                if (auto &copyTask = taskList.at(i);
+                    copyTask.command() == "copy") {
+                    task.pushIn(&copyTask);
                 }
             }
-            taskList.insert(std::move(list));
         }
     }
     if (auto in = root.property("in"); in) {
@@ -278,9 +336,7 @@ inline std::pair<TaskList, Task *> createTree(
                 throw std::runtime_error{"could not find name '" + name +
                                          "' at " + std::string{in->pos}};
             }
-            auto tree = createTree(file, *f, duplicateMap, style);
-            task.pushIn(tree.second);
-            taskList.insert(std::move(tree.first));
+            task.pushIn(createTree(file, *f, created, style, taskList));
         }
     }
     if (auto p = root.property("out")) {
@@ -311,6 +367,9 @@ inline std::pair<TaskList, Task *> createTree(
     if (auto p = root.property("config")) {
         task.config(p->values);
     }
+    if (auto p = root.property("pools")) {
+        task.pools(parsePools(*p));
+    }
     {
         auto &commands = root.ocommands();
 
@@ -321,32 +380,63 @@ inline std::pair<TaskList, Task *> createTree(
 
     task.generateDepName();
 
-    duplicateMap[task.out()] = &task;
+    created.files[task.out()] = &task;
+    created.targets.emplace(std::string{root.name()}, &task);
 
-    return {std::move(taskList), &task};
+    return &task;
 }
 
 } // namespace task
 
-inline TaskList createTasks(const MatmakeFile &file, std::string rootName) {
-    for (auto &node : file.nodes()) {
-        if (auto command = node.property("command")) {
-            if (command->value() == "[root]") {
-                if (node.name() == rootName) {
-                    // This map keeps track of o-files so that there is not
-                    // multiple versions of the same file
-                    auto duplicateMap = std::map<filesystem::path, Task *>{};
-                    auto tasks =
-                        task::createTree(
-                            file, node, duplicateMap, FlagStyle::Inherit)
-                            .first;
-                    prescan(tasks);
-                    calculateState(tasks);
-                    return tasks;
-                }
-            }
-        }
+//! Create only the root task without the tasks below it, eg to find the logs
+//! of earlier builds without searching for files
+//! @return a list with the root task, or an empty list if it does not exist
+inline TaskList createRootTask(const MatmakeFile &file,
+                               const std::string &rootName) {
+    auto tasks = TaskList{};
+
+    if (auto node = file.find(rootName)) {
+        task::setNodeProperties(*node, tasks.emplace());
     }
 
-    return {};
+    return tasks;
+}
+
+//! @param shouldSaveGraph save the tasks so that they can be loaded with
+//!        loadGraphCache() on the next build
+inline TaskList createTasks(const MatmakeFile &file,
+                            std::string rootName,
+                            bool shouldSaveGraph = false) {
+    auto node = file.find(rootName);
+    if (!node) {
+        return {};
+    }
+
+    auto command = node->property("command");
+    if (!command || command->value() != "[root]") {
+        return {};
+    }
+
+    // Keeps track of o-files so that there is not multiple versions of the
+    // same file
+    auto created = task::CreatedTasks{};
+    auto tasks = [&] {
+        auto span = TraceScope{"createTasks"};
+        auto tasks = TaskList{};
+        task::createTree(file, *node, created, FlagStyle::Inherit, tasks);
+        return tasks;
+    }();
+    {
+        auto span = TraceScope{"prescan"};
+        prescan(tasks);
+    }
+    if (shouldSaveGraph) {
+        auto span = TraceScope{"saveGraphCache"};
+        saveGraphCache(rootName, tasks, created.searchedPaths);
+    }
+    {
+        auto span = TraceScope{"calculateState"};
+        calculateState(tasks);
+    }
+    return tasks;
 }
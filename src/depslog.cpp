@@ -0,0 +1,224 @@
+#include "depslog.h"
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+namespace {
+
+constexpr auto depsLogHeader = std::string_view{"# matmake2 deps v1\n"};
+
+// Do not compact small files
+constexpr size_t minDepsCompactionRecords = 1000;
+
+// Compact when there is this many more records than files in the database
+constexpr size_t depsCompactionRatio = 3;
+
+constexpr char pathRecord = 'p';
+constexpr char depsRecord = 'd';
+
+template <typename T>
+void writeValue(std::ostream &stream, T value) {
+    stream.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+} // namespace
+
+DepsLog::DepsLog(filesystem::path path)
+    : _path(std::move(path)) {
+    auto file = std::ifstream{_path, std::ios::binary};
+
+    if (!file.is_open()) {
+        return;
+    }
+
+    // Read everything at once, the database is read on every build
+    auto data = std::string{std::istreambuf_iterator<char>{file}, {}};
+    file.close();
+
+    size_t pos = depsLogHeader.size();
+    bool isBroken = data.compare(0, pos, depsLogHeader) != 0;
+
+    auto read = [&](auto &value) {
+        if (pos + sizeof(value) > data.size()) {
+            return false;
+        }
+        std::memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    };
+
+    while (!isBroken && pos < data.size()) {
+        auto kind = data.at(pos);
+        ++pos;
+
+        if (kind == pathRecord) {
+            uint32_t size = 0;
+            if (!read(size) || pos + size > data.size()) {
+                isBroken = true;
+                break;
+            }
+            auto id = static_cast<uint32_t>(_paths.size());
+            _paths.push_back(data.substr(pos, size));
+            _pathIds[_paths.back()] = id;
+            pos += size;
+        }
+        else if (kind == depsRecord) {
+            uint32_t outId = 0;
+            uint32_t numDeps = 0;
+            auto record = DepsLogRecord{};
+            if (!read(outId) || !read(record.mtime) || !read(numDeps) ||
+                outId >= _paths.size()) {
+                isBroken = true;
+                break;
+            }
+            record.deps.reserve(numDeps);
+            for (uint32_t i = 0; i < numDeps; ++i) {
+                uint32_t id = 0;
+                if (!read(id) || id >= _paths.size()) {
+                    isBroken = true;
+                    break;
+                }
+                record.deps.push_back(&_paths.at(id));
+            }
+            if (isBroken) {
+                break;
+            }
+            _records[_paths.at(outId)] = std::move(record);
+            ++_numFileRecords;
+        }
+        else {
+            isBroken = true;
+        }
+    }
+
+    // A broken file is probably caused by a interrupted write, keep the
+    // records that could be read
+    if (isBroken || (_numFileRecords >= minDepsCompactionRecords &&
+                     _numFileRecords >= _records.size() * depsCompactionRatio)) {
+        compact();
+    }
+}
+
+const DepsLogRecord *DepsLog::find(const std::string &out) const {
+    if (auto f = _records.find(out); f != _records.end()) {
+        return &f->second;
+    }
+    return nullptr;
+}
+
+void DepsLog::record(const std::string &out,
+                     int64_t mtime,
+                     const std::vector<std::string_view> &deps) {
+    open();
+
+    auto outId = pathId(out);
+
+    auto ids = std::vector<uint32_t>{};
+    ids.reserve(deps.size());
+
+    auto record = DepsLogRecord{};
+    record.mtime = mtime;
+    record.deps.reserve(deps.size());
+
+    for (auto &dep : deps) {
+        auto id = pathId(dep);
+        ids.push_back(id);
+        record.deps.push_back(&_paths.at(id));
+    }
+
+    if (_file.is_open()) {
+        _file.put(depsRecord);
+        writeValue(_file, outId);
+        writeValue(_file, mtime);
+        writeValue(_file, static_cast<uint32_t>(ids.size()));
+        for (auto id : ids) {
+            writeValue(_file, id);
+        }
+        _file.flush(); // Keep the record even if the build is interrupted
+    }
+
+    _records[out] = std::move(record);
+    ++_numFileRecords;
+}
+
+//! Get the index of a path, new paths are added to the file
+uint32_t DepsLog::pathId(std::string_view path) {
+    if (auto f = _pathIds.find(path); f != _pathIds.end()) {
+        return f->second;
+    }
+
+    auto id = static_cast<uint32_t>(_paths.size());
+    _paths.emplace_back(path);
+    _pathIds.emplace(path, id);
+
+    if (_file.is_open()) {
+        _file.put(pathRecord);
+        writeValue(_file, static_cast<uint32_t>(path.size()));
+        _file.write(path.data(), static_cast<std::streamsize>(path.size()));
+    }
+
+    return id;
+}
+
+void DepsLog::open() {
+    if (_path.empty() || _file.is_open()) {
+        return;
+    }
+
+    auto ec = std::error_code{};
+    auto size = filesystem::file_size(_path, ec);
+    auto isNew = ec || size == 0;
+    if (_path.has_parent_path()) {
+        filesystem::create_directories(_path.parent_path(), ec);
+    }
+    _file.open(_path, std::ios::app | std::ios::binary);
+    if (isNew) {
+        _file << depsLogHeader;
+    }
+}
+
+//! Rewrite the file with only the latest record for each file
+void DepsLog::compact() {
+    if (_path.empty()) {
+        return;
+    }
+
+    auto tmpPath = _path;
+    tmpPath += ".tmp";
+
+    _file.close();
+    _file.open(tmpPath, std::ios::trunc | std::ios::binary);
+    if (!_file.is_open()) {
+        return;
+    }
+    _file << depsLogHeader;
+
+    // The old records points to the old paths
+    auto paths = std::move(_paths);
+    auto records = std::move(_records);
+
+    _paths.clear();
+    _pathIds.clear();
+    _records.clear();
+    _numFileRecords = 0;
+
+    auto deps = std::vector<std::string_view>{};
+    for (auto &it : records) {
+        deps.clear();
+        for (auto dep : it.second.deps) {
+            deps.push_back(*dep);
+        }
+        record(it.first, it.second.mtime, deps);
+    }
+
+    _file.close();
+
+    // The path ids is renumbered, so the old file can not be appended to if
+    // the new file could not be moved in place. Stop writing to it instead
+    auto ec = std::error_code{};
+    filesystem::rename(tmpPath, _path, ec);
+    if (ec) {
+        filesystem::remove(tmpPath, ec);
+        _path.clear();
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "filesystem.h"
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct DepsLogRecord {
+    int64_t mtime = 0; // Modification time of out when the deps was recorded
+    std::vector<const std::string *> deps;
+};
+
+//! Binary database with the dependencies found in depfiles, so that every
+//! depfile does not have to be parsed on every build
+//! The database is saved in the intermediate directory of the root target.
+//! Paths are stored once and referenced by index, and records are appended
+//! when files are built. Old records are removed when the file is loaded and
+//! has grown too large
+class DepsLog {
+public:
+    DepsLog() = default;
+
+    //! Load the database from a file, a missing or broken file is treated as
+    //! an empty database
+    DepsLog(filesystem::path path);
+
+    DepsLog(const DepsLog &) = delete;
+    DepsLog &operator=(const DepsLog &) = delete;
+    DepsLog(DepsLog &&) = default;
+    DepsLog &operator=(DepsLog &&) = default;
+
+    //! The latest deps recorded for a output file, nullptr if there is none
+    const DepsLogRecord *find(const std::string &out) const;
+
+    //! Add a record and append it to the database file
+    void record(const std::string &out,
+                int64_t mtime,
+                const std::vector<std::string_view> &deps);
+
+    //! Convert a modification time to the format stored in the database
+    static int64_t toMtime(filesystem::file_time_type time) {
+        return static_cast<int64_t>(time.time_since_epoch().count());
+    }
+
+    size_t size() const {
+        return _records.size();
+    }
+
+private:
+    uint32_t pathId(std::string_view path);
+    void open();
+    void writePath(const std::string &path);
+    void writeRecord(uint32_t outId, const DepsLogRecord &record);
+    void compact();
+
+    filesystem::path _path;
+    std::deque<std::string> _paths; // Deque to keep the pointers valid
+    std::map<std::string, uint32_t, std::less<>> _pathIds;
+    std::map<std::string, DepsLogRecord> _records;
+    size_t _numFileRecords = 0; // Including replaced records
+    std::ofstream _file;
+};
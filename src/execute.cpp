@@ -1,5 +1,7 @@
 #include "execute.h"
 #include "os.h"
+#include "process.h"
+#include <iostream>
 
 int execute(std::string filename, filesystem::path path) {
     auto originalPath = filesystem::absolute(filesystem::current_path());
@@ -9,9 +11,12 @@ int execute(std::string filename, filesystem::path path) {
         filename = "./" + filename;
     }
 
-    auto res = std::system(filename.c_str());
+    // Tests writes directly to the terminal so that their output is shown
+    // while they are running
+    std::cout.flush();
+    auto result = runProcess(filename, {}, nullptr, ProcessOutput::Inherit);
 
     filesystem::current_path(originalPath);
 
-    return res;
+    return result.status;
 }
@@ -0,0 +1,402 @@
+#include "graphcache.h"
+#include "binary.h"
+#include "depslog.h"
+#include "hash.h"
+#include "os.h"
+#include "prescan.h"
+#include "statcache.h"
+#include <array>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+
+#ifndef MATMAKE_USING_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Change the version when the format or the way tasks is created is changed
+constexpr auto graphCacheHeader = std::string_view{"matmake2 graph v2\n"};
+
+constexpr auto noTaskIndex = std::numeric_limits<uint32_t>::max();
+
+const auto graphMatmakeFiles =
+    std::array<filesystem::path, 2>{"Matmakefile", "matmake.json"};
+
+//! The default compilers is searched for in PATH when the Matmakefile is
+//! parsed
+uint64_t environmentHash() {
+    auto path = std::getenv("PATH");
+    return fnv1a(path ? path : "");
+}
+
+//! A read only view of a whole file
+class MappedFile {
+public:
+    MappedFile(const filesystem::path &path) {
+#ifdef MATMAKE_USING_WINDOWS
+        auto file = std::ifstream{path, std::ios::binary};
+        _buffer.assign(std::istreambuf_iterator<char>{file}, {});
+        _data = _buffer;
+#else
+        auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return;
+        }
+        struct stat buffer;
+        if (!fstat(fd, &buffer) && buffer.st_size > 0) {
+            auto size = static_cast<size_t>(buffer.st_size);
+            auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                _data = {static_cast<const char *>(data), size};
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+#ifndef MATMAKE_USING_WINDOWS
+        if (!_data.empty()) {
+            munmap(const_cast<char *>(_data.data()), _data.size());
+        }
+#endif
+    }
+
+    //! Empty if the file could not be read
+    std::string_view data() const {
+        return _data;
+    }
+
+private:
+    std::string_view _data;
+#ifdef MATMAKE_USING_WINDOWS
+    std::string _buffer;
+#endif
+};
+
+//! Files that the tasks was created from, the graph is out of date if any of
+//! them is changed, added or removed
+std::vector<filesystem::path> graphDependencies(
+    const TaskList &tasks, const std::vector<filesystem::path> &searchedPaths) {
+    auto paths = std::vector<filesystem::path>{graphMatmakeFiles.begin(),
+                                               graphMatmakeFiles.end()};
+    paths.insert(paths.end(), searchedPaths.begin(), searchedPaths.end());
+
+    // Module names and imports is found when prescanning
+    for (auto &task : tasks) {
+        if (getType(task->out()) != SourceType::ExpandedModuleSource) {
+            continue;
+        }
+        auto jsonFile = prescanResultPath(*task);
+        paths.push_back(task->out());
+        paths.push_back(jsonFile);
+        paths.push_back(task->in().front()->out());
+        for (auto &include : loadPrescanIncludes(jsonFile)) {
+            paths.push_back(include);
+        }
+    }
+
+    return paths;
+}
+
+void writeStrings(BinaryWriter &writer, const std::vector<std::string> &strs) {
+    writer.value(static_cast<uint32_t>(strs.size()));
+    for (auto &str : strs) {
+        writer.string(str);
+    }
+}
+
+std::vector<std::string> readStrings(BinaryReader &reader) {
+    auto strs = std::vector<std::string>(reader.value<uint32_t>());
+    for (auto &str : strs) {
+        str = reader.string();
+    }
+    return strs;
+}
+
+void writeProperties(BinaryWriter &writer, const TaskProperties &properties) {
+    for (auto str : {&properties.cxx,
+                     &properties.cc,
+                     &properties.ar,
+                     &properties.flags,
+                     &properties.ldflags,
+                     &properties.eflags,
+                     &properties.depprefix}) {
+        writer.string(str->str());
+    }
+    writeStrings(writer, properties.includes);
+    writeStrings(writer, properties.sysIncludes);
+    writeStrings(writer, properties.config);
+
+    writer.value(static_cast<uint32_t>(properties.commands.size()));
+    for (auto &command : properties.commands) {
+        writer.string(command.first);
+        writer.string(command.second);
+    }
+
+    writer.value(static_cast<uint32_t>(properties.pools.size()));
+    for (auto &pool : properties.pools) {
+        writer.string(pool.first);
+        writer.value(static_cast<uint64_t>(pool.second));
+    }
+}
+
+TaskProperties readProperties(BinaryReader &reader) {
+    auto properties = TaskProperties{};
+    for (auto str : {&properties.cxx,
+                     &properties.cc,
+                     &properties.ar,
+                     &properties.flags,
+                     &properties.ldflags,
+                     &properties.eflags,
+                     &properties.depprefix}) {
+        *str = reader.string();
+    }
+    properties.includes = readStrings(reader);
+    properties.sysIncludes = readStrings(reader);
+    properties.config = readStrings(reader);
+
+    for (auto i = reader.value<uint32_t>(); i > 0; --i) {
+        auto name = std::string{reader.string()};
+        properties.commands[name] = reader.string();
+    }
+
+    for (auto i = reader.value<uint32_t>(); i > 0; --i) {
+        auto name = std::string{reader.string()};
+        properties.pools[name] = static_cast<size_t>(reader.value<uint64_t>());
+    }
+
+    return properties;
+}
+
+std::optional<TaskList> readGraph(BinaryReader &reader,
+                                  const std::string &target) {
+    if (reader.string() != target ||
+        reader.value<uint64_t>() != environmentHash()) {
+        return {};
+    }
+
+    {
+        auto saveTime = reader.value<int64_t>();
+        auto paths = std::vector<filesystem::path>{};
+        auto stats = std::vector<std::pair<bool, int64_t>>{};
+        for (auto i = reader.value<uint32_t>(); i > 0; --i) {
+            paths.emplace_back(reader.string());
+            auto exists = reader.value<uint8_t>();
+            stats.emplace_back(exists, reader.value<int64_t>());
+        }
+
+        statCache().prefetch(paths);
+        for (size_t i = 0; i < paths.size(); ++i) {
+            auto stat = statCache().stat(paths.at(i));
+            if (stat.exists != stats.at(i).first ||
+                DepsLog::toMtime(stat.mtime) != stats.at(i).second) {
+                return {};
+            }
+
+            // Racily clean: the file could have been changed again after
+            // it was checked, without getting a new time stamp
+            if (stats.at(i).first && stats.at(i).second >= saveTime) {
+                return {};
+            }
+        }
+    }
+
+    auto properties = std::vector<std::shared_ptr<TaskProperties>>(
+        reader.value<uint32_t>());
+    for (auto &p : properties) {
+        p = std::make_shared<TaskProperties>(readProperties(reader));
+    }
+
+    auto tasks = TaskList{};
+    auto numTasks = reader.value<uint32_t>();
+    tasks.reserve(numTasks);
+
+    for (uint32_t i = 0; i < numTasks; ++i) {
+        auto &task = tasks.emplace();
+        task.readBinary(reader);
+        if (auto index = reader.value<uint32_t>(); index != noTaskIndex) {
+            task.sharedProperties(properties.at(index));
+        }
+    }
+
+    auto readTask = [&](uint32_t index) -> Task * {
+        if (index == noTaskIndex) {
+            return nullptr;
+        }
+        if (index >= numTasks) {
+            throw std::runtime_error{"task index out of range"};
+        }
+        return &tasks.at(index);
+    };
+
+    // Inputs changes the parents, so the parents is set last
+    auto parents = std::vector<Task *>{};
+    parents.reserve(numTasks);
+    for (auto &task : tasks) {
+        parents.push_back(readTask(reader.value<uint32_t>()));
+        for (auto i = reader.value<uint32_t>(); i > 0; --i) {
+            task->pushIn(readTask(reader.value<uint32_t>()));
+        }
+    }
+    for (uint32_t i = 0; i < numTasks; ++i) {
+        tasks.at(i).parent(parents.at(i));
+    }
+
+    if (!reader.atEnd()) {
+        return {};
+    }
+
+    return tasks;
+}
+
+} // namespace
+
+filesystem::path graphLocatorPath(const std::string &target) {
+    return projectStateDir() / ("graph_" + target);
+}
+
+filesystem::path graphCachePath(const Task &root) {
+    return root.dir(BuildLocation::Intermediate) / ".matmake_graph";
+}
+
+void saveGraphCache(const std::string &target,
+                    const TaskList &tasks,
+                    const std::vector<filesystem::path> &searchedPaths) {
+    auto root = tasks.findRoot();
+    if (!root) {
+        return;
+    }
+
+    // Write to a temporary file so that a interrupted write never looks like
+    // a valid graph
+    auto path = graphCachePath(*root);
+    auto tmpPath = path;
+    tmpPath += ".tmp";
+    auto file = std::ofstream{tmpPath, std::ios::binary | std::ios::trunc};
+    if (!file.is_open()) {
+        return;
+    }
+
+    // The time stamp of the new file comes from the same clock as the time
+    // stamps of the files that the graph depends on
+    auto ec = std::error_code{};
+    auto saveTime = filesystem::last_write_time(tmpPath, ec);
+    if (ec) {
+        return;
+    }
+
+    auto writer = BinaryWriter{};
+    writer.string(target);
+    writer.value(environmentHash());
+    writer.value(DepsLog::toMtime(saveTime));
+
+    {
+        auto paths = graphDependencies(tasks, searchedPaths);
+        writer.value(static_cast<uint32_t>(paths.size()));
+        for (auto &path : paths) {
+            auto stat = statCache().stat(path);
+            writer.string(path.string());
+            writer.value(static_cast<uint8_t>(stat.exists));
+            writer.value(DepsLog::toMtime(stat.mtime));
+        }
+    }
+
+    // Properties is often shared by many tasks and is only saved once
+    auto propertyIndices =
+        std::unordered_map<const TaskProperties *, uint32_t>{};
+    auto properties = std::vector<const TaskProperties *>{};
+    for (auto &task : tasks) {
+        if (auto &p = task->sharedProperties()) {
+            if (propertyIndices
+                    .emplace(p.get(), static_cast<uint32_t>(properties.size()))
+                    .second) {
+                properties.push_back(p.get());
+            }
+        }
+    }
+
+    writer.value(static_cast<uint32_t>(properties.size()));
+    for (auto p : properties) {
+        writeProperties(writer, *p);
+    }
+
+    auto taskIndex = [&](const Task *task) {
+        return tasks.contains(task) ? task->index() : noTaskIndex;
+    };
+
+    writer.value(static_cast<uint32_t>(tasks.size()));
+    for (auto &task : tasks) {
+        task->writeBinary(writer);
+        auto &p = task->sharedProperties();
+        writer.value(p ? propertyIndices.at(p.get()) : noTaskIndex);
+    }
+
+    for (auto &task : tasks) {
+        writer.value(taskIndex(task->parent()));
+        auto &in = task->in();
+        writer.value(static_cast<uint32_t>(in.size()));
+        for (auto i : in) {
+            writer.value(taskIndex(i));
+        }
+    }
+
+    file << graphCacheHeader;
+    file.write(writer.buffer().data(),
+               static_cast<std::streamsize>(writer.buffer().size()));
+    file.close();
+
+    // The graph is only a cache, a full or read only disk should not stop
+    // the build
+    if (!file) {
+        filesystem::remove(tmpPath, ec);
+        return;
+    }
+    filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        filesystem::remove(tmpPath, ec);
+        return;
+    }
+
+    // The locator is only written when it is changed
+    auto locatorPath = graphLocatorPath(target);
+    auto oldPath = std::string{};
+    std::getline(std::ifstream{locatorPath}, oldPath);
+    if (oldPath != path.string()) {
+        filesystem::create_directories(locatorPath.parent_path(), ec);
+        std::ofstream{locatorPath} << path.string() << "\n";
+    }
+}
+
+std::optional<TaskList> loadGraphCache(const std::string &target) {
+    auto path = std::string{};
+    std::getline(std::ifstream{graphLocatorPath(target)}, path);
+    if (path.empty()) {
+        return {};
+    }
+
+    auto file = MappedFile{path};
+    auto data = file.data();
+    if (data.substr(0, graphCacheHeader.size()) != graphCacheHeader) {
+        return {};
+    }
+    data.remove_prefix(graphCacheHeader.size());
+
+    try {
+        auto reader = BinaryReader{data};
+        return readGraph(reader, target);
+    }
+    catch (std::runtime_error &) {
+        return {}; // Broken file
+    }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "filesystem.h"
+#include "tasklist.h"
+#include <optional>
+#include <string>
+#include <vector>
+
+//! The task graph of a target is saved when it has been created and
+//! prescanned, so that builds where no files is added, removed or prescanned
+//! again does not need to parse the Matmakefile, search directories and load
+//! prescan results
+//! The graph is saved in the intermediate directory of the root. A file in
+//! projectStateDir() tells where it is, since the directory is not known
+//! before the Matmakefile is parsed
+//! Files that is changed in the same tick as the graph is saved can not be
+//! told apart from the saved time stamps, so such graphs is never loaded
+
+//! File in projectStateDir() with the path to the saved graph of a target
+filesystem::path graphLocatorPath(const std::string &target);
+
+//! Path to the saved graph of a build
+filesystem::path graphCachePath(const Task &root);
+
+//! Save the tasks of a target, before their state is calculated
+//! @param searchedPaths directories that was searched for source files
+void saveGraphCache(const std::string &target,
+                    const TaskList &tasks,
+                    const std::vector<filesystem::path> &searchedPaths);
+
+//! Load the saved tasks of a target, the state of the tasks is not calculated
+//! @return nothing if there is no saved graph or if any of the files it was
+//!         created from has changed
+std::optional<TaskList> loadGraphCache(const std::string &target);
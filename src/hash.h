@@ -0,0 +1,58 @@
+#pragma once
+
+#include "filesystem.h"
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+//! 64 bit FNV-1a hash, used to detect changes in commands and files
+//! Continue hashing by passing the previous result as the second argument
+constexpr uint64_t fnv1a(std::string_view data,
+                         uint64_t hash = 0xcbf29ce484222325ull) {
+    for (auto c : data) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline std::string hashToString(uint64_t hash) {
+    constexpr auto digits = std::string_view{"0123456789abcdef"};
+    auto str = std::string(16, '0');
+    for (size_t i = 0; i < 16; ++i) {
+        str[15 - i] = digits[(hash >> (i * 4)) & 0xf];
+    }
+    return str;
+}
+
+inline uint64_t hashFromString(std::string_view str) {
+    uint64_t hash = 0;
+    for (auto c : str) {
+        hash <<= 4;
+        if (c >= '0' && c <= '9') {
+            hash |= static_cast<uint64_t>(c - '0');
+        }
+        else if (c >= 'a' && c <= 'f') {
+            hash |= static_cast<uint64_t>(c - 'a' + 10);
+        }
+    }
+    return hash;
+}
+
+//! Hash the content of a file, returns nothing if the file could not be read
+inline std::optional<uint64_t> hashFile(const filesystem::path &path) {
+    auto file = std::ifstream{path, std::ios::binary};
+    if (!file.is_open()) {
+        return {};
+    }
+
+    auto hash = fnv1a({});
+    char buffer[4096];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        hash = fnv1a({buffer, static_cast<size_t>(file.gcount())}, hash);
+    }
+
+    return hash;
+}
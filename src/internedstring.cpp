@@ -0,0 +1,33 @@
+#include "internedstring.h"
+#include <mutex>
+#include <unordered_set>
+
+namespace {
+
+struct InternTable {
+    std::mutex mutex;
+    // Nodes in unordered_set is not moved when the table grows
+    std::unordered_set<std::string> strings;
+};
+
+InternTable &internTable() {
+    static auto table = InternTable{};
+    return table;
+}
+
+} // namespace
+
+InternedString::InternedString(std::string_view str) {
+    if (str.empty()) {
+        return;
+    }
+
+    auto &table = internTable();
+    auto lock = std::scoped_lock{table.mutex};
+    _str = &*table.strings.emplace(str).first;
+}
+
+const std::string &InternedString::emptyString() {
+    static const auto str = std::string{};
+    return str;
+}
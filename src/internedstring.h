@@ -0,0 +1,39 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+//! A string that is stored once in a global table, used for values that is
+//! repeated on many tasks, eg commands and directories
+//! Copying and comparing is as cheap as for a pointer. Strings is never
+//! removed from the table
+class InternedString {
+public:
+    InternedString() = default;
+    InternedString(std::string_view str);
+    InternedString(const std::string &str)
+        : InternedString{std::string_view{str}} {}
+    InternedString(const char *str)
+        : InternedString{std::string_view{str}} {}
+
+    const std::string &str() const {
+        return _str ? *_str : emptyString();
+    }
+
+    bool empty() const {
+        return !_str;
+    }
+
+    bool operator==(const InternedString &other) const {
+        return _str == other._str;
+    }
+
+    bool operator!=(const InternedString &other) const {
+        return _str != other._str;
+    }
+
+private:
+    static const std::string &emptyString();
+
+    const std::string *_str = nullptr; // nullptr for empty strings
+};
@@ -0,0 +1,196 @@
+#include "jobserver.h"
+#include "os.h"
+#include <cstdlib>
+#include <iostream>
+
+#ifndef MATMAKE_USING_WINDOWS
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifndef MATMAKE_USING_WINDOWS
+
+bool isValidFd(int fd) {
+    return fd >= 0 && fcntl(fd, F_GETFD) != -1;
+}
+
+//! Open the same pipe or fifo again with its own file status flags, so that
+//! it can be read without blocking while other processes that shares the
+//! original file still reads it blocking
+//! @return -1 if the platform does not support it
+int openNonBlocking(int fd) {
+    auto path = "/proc/self/fd/" + std::to_string(fd);
+    return open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+#endif
+
+} // namespace
+
+JobServer::JobServer(size_t numJobs) {
+#ifndef MATMAKE_USING_WINDOWS
+    auto makeflags = getenv("MAKEFLAGS");
+
+    if (!makeflags || !connect(makeflags)) {
+        createServer(numJobs);
+    }
+
+    if (isActive()) {
+        _nonBlockingReadFd = openNonBlocking(_readFd);
+    }
+#endif
+}
+
+JobServer::~JobServer() {
+#ifndef MATMAKE_USING_WINDOWS
+    for (auto token : _tokens) {
+        [[maybe_unused]] auto res = write(_writeFd, &token, 1);
+    }
+
+    if (_nonBlockingReadFd >= 0) {
+        close(_nonBlockingReadFd);
+    }
+
+    if (!_isClient) {
+        if (_readFd >= 0) {
+            close(_readFd);
+        }
+        if (_writeFd >= 0) {
+            close(_writeFd);
+        }
+    }
+#endif
+}
+
+//! Parse MAKEFLAGS from a parent make, eg " -j8 --jobserver-auth=3,4"
+//! Both the pipe style (R,W) and fifo style (fifo:PATH) is supported
+bool JobServer::connect(const std::string &makeflags) {
+#ifdef MATMAKE_USING_WINDOWS
+    return false;
+#else
+    auto value = std::string{};
+
+    for (auto name : {"--jobserver-auth=", "--jobserver-fds="}) {
+        // The last one is the one that counts
+        if (auto f = makeflags.rfind(name); f != std::string::npos) {
+            auto begin = f + std::string{name}.size();
+            value = makeflags.substr(begin, makeflags.find(' ', begin) - begin);
+            break;
+        }
+    }
+
+    if (value.empty()) {
+        return false;
+    }
+
+    if (value.rfind("fifo:", 0) == 0) {
+        auto path = value.substr(5);
+        _readFd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        _writeFd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    }
+    else if (auto comma = value.find(','); comma != std::string::npos) {
+        _readFd = std::atoi(value.substr(0, comma).c_str());
+        _writeFd = std::atoi(value.substr(comma + 1).c_str());
+    }
+
+    if (!isValidFd(_readFd) || !isValidFd(_writeFd)) {
+        // Make closes the pipe for commands that is not marked as recursive
+        std::cerr << "warning: jobserver in MAKEFLAGS is not available, add "
+                     "'+' to the parent make rule\n";
+        _readFd = -1;
+        _writeFd = -1;
+        return false;
+    }
+
+    _isClient = true;
+
+    return true;
+#endif
+}
+
+void JobServer::createServer(size_t numJobs) {
+#ifndef MATMAKE_USING_WINDOWS
+    int fds[2];
+
+    // The pipe is inherited by child processes on purpose
+    if (pipe(fds)) {
+        return;
+    }
+
+    _readFd = fds[0];
+    _writeFd = fds[1];
+
+    // One slot is implicit
+    for (size_t i = 1; i < numJobs; ++i) {
+        char token = '+';
+        [[maybe_unused]] auto res = write(_writeFd, &token, 1);
+    }
+
+    auto makeflags = std::string{};
+    if (auto oldFlags = getenv("MAKEFLAGS")) {
+        makeflags = oldFlags;
+    }
+
+    makeflags += " -j" + std::to_string(numJobs) +
+                 " --jobserver-auth=" + std::to_string(_readFd) + "," +
+                 std::to_string(_writeFd);
+
+    setenv("MAKEFLAGS", makeflags.c_str(), true);
+#endif
+}
+
+bool JobServer::acquire(std::chrono::milliseconds timeout) {
+    {
+        auto lock = std::scoped_lock{_mutex};
+        if (!_isImplicitSlotUsed) {
+            _isImplicitSlotUsed = true;
+            return true;
+        }
+    }
+
+    if (!isActive()) {
+        return true;
+    }
+
+#ifdef MATMAKE_USING_WINDOWS
+    return true;
+#else
+    // Another process can take the token between poll() and read(), a
+    // blocking read would then wait until some token is returned and could
+    // not be stopped
+    auto readFd = (_nonBlockingReadFd >= 0) ? _nonBlockingReadFd : _readFd;
+    auto fd = pollfd{readFd, POLLIN, 0};
+
+    if (poll(&fd, 1, static_cast<int>(timeout.count())) <= 0) {
+        return false;
+    }
+
+    char token = 0;
+    if (read(readFd, &token, 1) != 1) {
+        return false; // Someone else was faster (EAGAIN)
+    }
+
+    auto lock = std::scoped_lock{_mutex};
+    _tokens.push_back(token);
+
+    return true;
+#endif
+}
+
+void JobServer::release() {
+    auto lock = std::scoped_lock{_mutex};
+
+    if (_tokens.empty()) {
+        _isImplicitSlotUsed = false;
+        return;
+    }
+
+#ifndef MATMAKE_USING_WINDOWS
+    auto token = _tokens.back();
+    _tokens.pop_back();
+    [[maybe_unused]] auto res = write(_writeFd, &token, 1);
+#endif
+}
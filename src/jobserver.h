@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Shares job slots with other build tools through the GNU make jobserver
+//! protocol
+//!
+//! If matmake2 is started from make with a jobserver the slots are taken
+//! from that jobserver (client mode). Otherwise a new jobserver is created
+//! and advertised in MAKEFLAGS so that make and other tools started from
+//! matmake2 share the same number of slots (server mode)
+//!
+//! Every process owns one implicit slot, the rest is read as tokens from the
+//! jobserver pipe and must be written back when the job is done
+class JobServer {
+public:
+    //! @param numJobs number of slots when acting as server
+    JobServer(size_t numJobs);
+    JobServer(const JobServer &) = delete;
+    JobServer &operator=(const JobServer &) = delete;
+    ~JobServer();
+
+    //! Wait for a free job slot
+    //! @return false if no slot was available before the timeout
+    bool acquire(std::chrono::milliseconds timeout);
+
+    //! Give back a slot taken with acquire()
+    void release();
+
+    //! True if matmake2 is running inside another jobserver
+    bool isClient() const {
+        return _isClient;
+    }
+
+    //! The jobserver is not supported on all platforms
+    bool isActive() const {
+        return _readFd >= 0;
+    }
+
+private:
+    bool connect(const std::string &makeflags);
+    void createServer(size_t numJobs);
+
+    int _readFd = -1;
+    int _writeFd = -1;
+    int _nonBlockingReadFd = -1; // Same pipe as _readFd
+    bool _isClient = false;
+
+    std::mutex _mutex;
+    bool _isImplicitSlotUsed = false;
+    std::vector<char> _tokens; // Tokens read from the jobserver
+};
@@ -1,8 +1,11 @@
 ﻿// copyright Mattias Larsson Sköld 2021
 
+#include "buildlog.h"
 #include "coordinator.h"
 #include "createtasks.h"
 #include "filesystem.h"
+#include "graphcache.h"
+#include "jobserver.h"
 #include "makefile.h"
 #include "matmakefile.h"
 #include "msvcenvironment.h"
@@ -11,31 +14,50 @@
 #include "settings.h"
 #include "tasklist.h"
 #include "test.h"
+#include "trace.h"
+#include "watch.h"
 #include "json/json.h"
 
 namespace {
 
+Json loadMatmakefile() {
+    if (filesystem::exists("Matmakefile")) {
+        return parseMatmakefile("Matmakefile");
+    }
+    else if (filesystem::exists("matmake.json")) {
+        return Json::LoadFile("matmake.json");
+    }
+    else {
+        std::cerr << "no matmakefile found in directory\n";
+        return {};
+    }
+}
+
 TaskList createTasksFromMatmakefile(const Settings &settings) {
-    auto getJson = [&]() -> Json {
-        if (filesystem::exists("Matmakefile")) {
-            return parseMatmakefile("Matmakefile");
-        }
-        else if (filesystem::exists("matmake.json")) {
-            return Json::LoadFile("matmake.json");
+    // The Matmakefile is only parsed if something that the tasks depends on
+    // has changed since the last build
+    if (!settings.debugPrint) {
+        auto tasks = [&] {
+            auto span = TraceScope{"loadGraphCache"};
+            return loadGraphCache(settings.target);
+        }();
+        if (tasks) {
+            auto span = TraceScope{"calculateState"};
+            calculateState(*tasks);
+            return std::move(*tasks);
         }
-        else {
-            std::cerr << "no matmakefile found in directory\n";
-            return {};
-        }
-    };
+    }
 
-    auto matmakeFile = MatmakeFile{getJson(), settings.target};
+    auto matmakeFile = [&] {
+        auto span = TraceScope{"parse Matmakefile"};
+        return MatmakeFile{loadMatmakefile(), settings.target};
+    }();
 
     if (settings.debugPrint) {
         matmakeFile.print(std::cout);
     }
 
-    return createTasks(matmakeFile, settings.target);
+    return createTasks(matmakeFile, settings.target, true);
 }
 
 int parseTasksCommand(const Settings settings) {
@@ -91,7 +113,7 @@ void outputCompileCommands(const TaskList &tasks) {
         auto taskJson = Json{Json::Object};
 
         taskJson["directory"] = dir.string();
-        taskJson["command"] = ProcessedCommand{command}.expand(*task);
+        taskJson["command"] = ProcessedCommand::cached(command).expand(*task);
         auto source = task->findSource();
         if (!source) {
             std::cerr << "could not find source file for " << task->out();
@@ -109,7 +131,7 @@ void outputCompileCommands(const TaskList &tasks) {
     std::ofstream{"compile_commands.json"} << json;
 }
 
-int build(const Settings &settings) {
+TaskList createTargetTasks(const Settings &settings) {
     auto tasks = createTasksFromMatmakefile(settings);
 
     if (settings.target.empty()) {
@@ -121,6 +143,12 @@ int build(const Settings &settings) {
         throw std::runtime_error{"could not find target " + settings.target};
     }
 
+    return tasks;
+}
+
+int build(const Settings &settings, JobServer &jobServer) {
+    auto tasks = createTargetTasks(settings);
+
     if (settings.printTree) {
         std::cout << "\n"
                      "treeview\n"
@@ -141,7 +169,7 @@ int build(const Settings &settings) {
     }
 
     if (!settings.skipBuild) {
-        auto coordinator = Coordinator{};
+        auto coordinator = Coordinator{&jobServer};
         auto status = coordinator.execute(tasks, settings);
 
         if (status) {
@@ -164,15 +192,7 @@ int build(const Settings &settings) {
 }
 
 int list(const Settings &settings) {
-    auto json = [] {
-        if (filesystem::exists("Matmakefile")) {
-            return parseMatmakefile("Matmakefile");
-        }
-
-        return Json::LoadFile("matmake.json");
-    }();
-
-    auto matmakeFile = MatmakeFile{json};
+    auto matmakeFile = MatmakeFile{loadMatmakefile()};
 
     for (auto &node : matmakeFile.nodes()) {
         if (node.isRoot()) {
@@ -183,6 +203,33 @@ int list(const Settings &settings) {
     return 0;
 }
 
+int stats(const Settings &settings) {
+    if (settings.target.empty()) {
+        throw std::runtime_error{
+            "no target specified. Use \"--target\" to specify"};
+    }
+
+    auto matmakeFile = MatmakeFile{loadMatmakefile(), settings.target};
+
+    // The same path as the build uses
+    auto tasks = createRootTask(matmakeFile, settings.target);
+    if (tasks.empty()) {
+        throw std::runtime_error{"could not find target " + settings.target};
+    }
+
+    auto path = buildLogPath(tasks.front());
+    auto log = BuildLog{path};
+
+    if (log.empty()) {
+        std::cout << "no build log found in " << path.parent_path() << "\n";
+        return 0;
+    }
+
+    log.printStats(std::cout, settings.numStatsBuilds);
+
+    return 0;
+}
+
 int clean(const Settings settings) {
     auto tasks = createTasksFromMatmakefile(settings);
 
@@ -211,6 +258,9 @@ int main(int argc, char **argv) {
             break;
         case Command::Build:
         case Command::BuildAndTest: {
+            // Share job slots with make and other tools started from here
+            auto jobServer = JobServer{settings.numThreads};
+
             switch (settings.backend) {
             case Backend::Default:
             case Backend::Ninja:
@@ -219,10 +269,37 @@ int main(int argc, char **argv) {
                 break;
             case Backend::Makefile:
                 return printMakefile(settings,
-                                     createTasksFromMatmakefile(settings));
+                                     createTasksFromMatmakefile(settings),
+                                     &jobServer);
                 break;
-            case Backend::Native:
-                return build(settings);
+            case Backend::Native: {
+                if (settings.watch) {
+                    return watch(settings, jobServer, [&settings] {
+                        return createTargetTasks(settings);
+                    });
+                }
+
+                if (settings.command == Command::Build &&
+                    !settings.skipBuild && !settings.printTree &&
+                    !settings.outputCompileCommands &&
+                    settings.traceFile.empty()) {
+                    if (auto status = buildWithWatch(settings)) {
+                        return *status;
+                    }
+                }
+
+                if (!settings.traceFile.empty()) {
+                    startTrace();
+                }
+
+                auto status = build(settings, jobServer);
+
+                if (auto t = trace()) {
+                    t->save(settings.traceFile);
+                }
+
+                return status;
+            }
             }
         } break;
         case Command::List: {
@@ -231,6 +308,9 @@ int main(int argc, char **argv) {
         case Command::Clean: {
             return clean(settings);
         } break;
+        case Command::Stats: {
+            return stats(settings);
+        } break;
         }
     }
     catch (std::runtime_error &e) {
@@ -1,5 +1,6 @@
 #include "makefile.h"
 #include "createtasks.h"
+#include "jobserver.h"
 #include "tasklist.h"
 #include <fstream>
 #include "test.h"
@@ -17,6 +18,9 @@ void writeToFile(filesystem::path dir, const TaskList &tasks) {
 
     std::cout << "printing makefile..." << std::endl;
 
+    // Reused for every task to avoid allocations
+    auto command = std::string{};
+
     for (auto &task : tasks) {
         auto rawCommand = task->command();
         auto name = task->name();
@@ -53,7 +57,8 @@ void writeToFile(filesystem::path dir, const TaskList &tasks) {
                  << "cp -u " << in << " " << task->out().string() << "\n";
         }
         else {
-            auto command = ProcessedCommand{rawCommand}.expand(*task);
+            command.clear();
+            ProcessedCommand::cached(rawCommand).expand(*task, command);
             file << "\t" << command << "\n";
         }
     }
@@ -61,7 +66,9 @@ void writeToFile(filesystem::path dir, const TaskList &tasks) {
 
 } // namespace
 
-int printMakefile(const Settings &settings, const TaskList &tasks) {
+int printMakefile(const Settings &settings,
+                  const TaskList &tasks,
+                  const JobServer *jobServer) {
     if (settings.target.empty()) {
         throw std::runtime_error{
             "no target specified. Use \"--target\" to specify"};
@@ -88,7 +95,13 @@ int printMakefile(const Settings &settings, const TaskList &tasks) {
 
     if (!settings.skipBuild) {
         std::cout.flush();
-        auto status = system(("make -j -f " + dir.string()).c_str());
+        // The number of jobs is limited by the jobserver in MAKEFLAGS if
+        // there is one
+        auto command = "make -f " + dir.string();
+        if (!jobServer || !jobServer->isActive()) {
+            command += " -j" + std::to_string(settings.numThreads);
+        }
+        auto status = system(command.c_str());
 
         if (status) {
             std::cout << "failed...\n";
@@ -4,4 +4,10 @@
 #include "task.h"
 #include "tasklist.h"
 
-int printMakefile(const Settings &settings, const TaskList &tasks);
+class JobServer;
+
+//! @param jobServer limits the number of jobs of make when it is active,
+//!        otherwise make is started with -j
+int printMakefile(const Settings &settings,
+                  const TaskList &tasks,
+                  const JobServer *jobServer = nullptr);
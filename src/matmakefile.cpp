@@ -48,39 +48,57 @@ MatmakeFile::MatmakeFile(const Json &json, std::string_view targetName) {
         defaultNodes.emplace_back(j, targetName);
     }
 
+    _nodes.reserve(json.size() + defaultNodes.size());
+    _index.reserve(json.size() + defaultNodes.size());
+
     for (auto &n : defaultNodes) {
-        _nodes.emplace_back(std::move(n));
+        add(std::move(n));
     }
 
-    _nodes.reserve(json.size() + _nodes.size());
-
-    auto nonConstFind = [this](std::string_view name) -> MatmakeNode * {
-        for (auto &node : _nodes) {
-            if (node.name() == name) {
-                return &node;
-            }
+    for (auto &j : json) {
+        auto node = MatmakeNode{j, targetName};
+        if (!tryMerge(node, targetName)) {
+            add(std::move(node));
         }
+    }
+}
+
+void MatmakeFile::add(MatmakeNode node) {
+    auto index = _nodes.size();
+    _index.emplace(std::string{node.name()}, index);
+    if (node.property("root")) {
+        _rootCandidates.push_back(index);
+    }
+    _nodes.push_back(std::move(node));
+}
 
-        return nullptr;
-    };
+bool MatmakeFile::tryMerge(const MatmakeNode &newNode,
+                           std::string_view targetName) {
+    auto name = newNode.name();
 
-    // Try to apply new node to other nodes
-    auto tryMerge = [this, targetName](const MatmakeNode &newNode) {
-        bool success = false;
-        for (auto &node : _nodes) {
-            if (node.merge(newNode, targetName)) {
-                success = true;
-            }
+    // "!name" applies to every root node except "name", other nodes only
+    // to the node with the same name
+    if (name.substr(0, 1) != "!") {
+        auto f = _index.find(std::string{name});
+        if (f == _index.end()) {
+            return false;
         }
-        return success;
-    };
+        auto &node = _nodes.at(f->second);
+        bool hadRoot = node.property("root");
+        node.merge(newNode, targetName);
+        if (!hadRoot && node.property("root")) {
+            _rootCandidates.push_back(f->second);
+        }
+        return true;
+    }
 
-    for (auto &j : json) {
-        auto node = MatmakeNode{j, targetName};
-        if (!tryMerge(node)) {
-            _nodes.emplace_back(std::move(node));
+    bool success = false;
+    for (auto index : _rootCandidates) {
+        if (_nodes.at(index).merge(newNode, targetName)) {
+            success = true;
         }
     }
+    return success;
 }
 
 MatmakeNode::MatmakeNode(const Json &json, std::string_view targetName) {
@@ -3,6 +3,8 @@
 #include "property.h"
 #include "json/json.h"
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 
 // Contains data loaded from json object
 class MatmakeNode {
@@ -66,19 +68,30 @@ public:
         }
     }
 
-    const std::vector<MatmakeNode> nodes() const {
+    const std::vector<MatmakeNode> &nodes() const {
         return _nodes;
     }
 
-    const MatmakeNode *find(std::string name) const {
-        for (auto &child : _nodes) {
-            if (child.name() == name) {
-                return &child;
-            }
+    const MatmakeNode *find(const std::string &name) const {
+        if (auto f = _index.find(name); f != _index.end()) {
+            return &_nodes.at(f->second);
         }
 
         return nullptr;
     }
 
     std::vector<MatmakeNode> _nodes;
+
+private:
+    void add(MatmakeNode node);
+
+    //! Merge a node into the existing nodes it applies to
+    //! @return false if there was none
+    bool tryMerge(const MatmakeNode &node, std::string_view targetName);
+
+    // Position of each node in _nodes by name, the first node wins
+    std::unordered_map<std::string, size_t> _index;
+
+    // Nodes with a root property, that "!name" nodes can be merged into
+    std::vector<size_t> _rootCandidates;
 };
@@ -1,7 +1,6 @@
 #include "nativecommands.h"
 #include "filesystem.h"
 #include "task.h"
-#include <iostream>
 
 native::CommandType native::findCommand(std::string name) {
     if (name.empty()) {
@@ -29,8 +28,6 @@ native::CommandStatus native::copy(const Task &task) {
     auto in = task.in().front()->out();
     auto out = task.out();
 
-    std::cout << (in.string() + " --> " + out.string()) << std::endl;
-
     if (filesystem::equivalent(in, out)) {
         return CommandStatus::Normal;
     }
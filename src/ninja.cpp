@@ -25,6 +25,9 @@ void writeNinjaToFile(filesystem::path dir, const TaskList &tasks) {
     file << "rule copy\n";
     file << "    command = cp -u $in $out\n\n";
 
+    // Reused for every task to avoid allocations
+    auto command = std::string{};
+
     for (auto &task : tasks) {
         auto rawCommand = task->command();
         auto name = task->name();
@@ -59,7 +62,8 @@ void writeNinjaToFile(filesystem::path dir, const TaskList &tasks) {
                  << "\n\n";
         }
         else {
-            auto command = ProcessedCommand{rawCommand}.expand(*task);
+            command.clear();
+            ProcessedCommand::cached(rawCommand).expand(*task, command);
 
             if (command.empty()) {
                 file << "build " << task->name() << ": phony " << in << "\n\n";
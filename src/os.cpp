@@ -1,5 +1,33 @@
 #include "os.h"
+#include <cstdlib>
+#include <fstream>
 #include <stdexcept>
+#include <thread>
+
+#ifdef MATMAKE_USING_WINDOWS
+#include <io.h>
+#else
+#include <csignal>
+#include <ctime>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifndef MATMAKE_USING_WINDOWS
+
+sigset_t interruptSignals() {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGHUP);
+    return set;
+}
+
+#endif
+
+} // namespace
 
 bool hasCommand(std::string command) {
     if constexpr (getOs() == Os::Linux) {
@@ -11,3 +39,71 @@ bool hasCommand(std::string command) {
                                  " is not implemented "};
     }
 }
+
+std::optional<double> loadAverage() {
+#ifdef MATMAKE_USING_WINDOWS
+    return {};
+#else
+    double load = 0;
+    if (getloadavg(&load, 1) != 1) {
+        return {};
+    }
+    return load;
+#endif
+}
+
+std::optional<size_t> availableMemory() {
+    auto file = std::ifstream{"/proc/meminfo"};
+
+    for (std::string name; file >> name;) {
+        if (name == "MemAvailable:") {
+            size_t kb = 0;
+            if (file >> kb) {
+                return kb * 1024;
+            }
+            return {};
+        }
+        file.ignore(256, '\n');
+    }
+
+    return {};
+}
+
+bool isTerminal() {
+#ifdef MATMAKE_USING_WINDOWS
+    return _isatty(_fileno(stdout));
+#else
+    return isatty(STDOUT_FILENO);
+#endif
+}
+
+void blockInterrupts() {
+#ifndef MATMAKE_USING_WINDOWS
+    auto set = interruptSignals();
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+#endif
+}
+
+void unblockInterrupts() {
+#ifndef MATMAKE_USING_WINDOWS
+    auto set = interruptSignals();
+    pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+#endif
+}
+
+int waitForInterrupt(std::chrono::milliseconds timeout) {
+#ifdef MATMAKE_USING_WINDOWS
+    std::this_thread::sleep_for(timeout);
+    return 0;
+#else
+    auto set = interruptSignals();
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    auto time = timespec{};
+    time.tv_sec = static_cast<time_t>(seconds.count());
+    time.tv_nsec = static_cast<long>(
+        std::chrono::nanoseconds{timeout - seconds}.count());
+
+    auto signal = sigtimedwait(&set, nullptr, &time);
+    return signal > 0 ? signal : 0;
+#endif
+}
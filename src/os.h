@@ -1,5 +1,8 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
+#include <optional>
 #include <string>
 
 enum Os {
@@ -19,3 +22,23 @@ constexpr Os getOs() {
 }
 
 bool hasCommand(std::string command);
+
+//! The one minute load average of the system, if available
+std::optional<double> loadAverage();
+
+//! Memory available for new processes in bytes, if available
+std::optional<size_t> availableMemory();
+
+//! True if standard output is a terminal
+bool isTerminal();
+
+//! Block SIGINT, SIGTERM and SIGHUP in the calling thread and the threads
+//! that it starts, so that they can be handled with waitForInterrupt()
+void blockInterrupts();
+
+//! Restore signals blocked with blockInterrupts()
+void unblockInterrupts();
+
+//! Wait for a blocked interrupt signal
+//! @return the signal number, or 0 on timeout
+int waitForInterrupt(std::chrono::milliseconds timeout);
@@ -1,47 +1,150 @@
 #pragma once
 
 #include "filesystem.h"
+#include <cstring>
 #include <fstream>
-#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+//! Keep one of these and reuse it for many files to avoid allocations
 struct DepFileContent {
-    std::vector<filesystem::path> deps;
+    std::string buffer; // The content of the file
+    std::string paths;  // Storage for unescaped paths
+    std::vector<std::string_view> deps; // Points into paths
 };
 
-DepFileContent parseDepFile(filesystem::path path) {
-    DepFileContent ret;
-    auto file = std::ifstream{path};
+//! Parse the first rule of a make style depfile that is already loaded into
+//! content.buffer
+//! Escaped spaces ("\ "), "\#", "$$" and line continuations is handled.
+//! Relative paths is prefixed with "./" and absolute paths (system headers) is
+//! skipped
+inline void parseDepFileBuffer(DepFileContent &content) {
+    content.paths.clear();
+    content.deps.clear();
 
-    if (!file.is_open()) {
-        return {};
-    }
+    auto &paths = content.paths;
+    paths.reserve(content.buffer.size() * 2);
+
+    // The buffer is null terminated which stops the scan at the end
+    const char *p = content.buffer.c_str();
+    const char *end = p + content.buffer.size();
+
+    auto isSpace = [](char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\0';
+    };
 
-    bool isFirstLine = true;
+    auto isContinuation = [&](const char *c) {
+        return c[0] == '\\' && (c[1] == '\n' || (c[1] == '\r' && c[2] == '\n'));
+    };
 
-    for (std::string line; std::getline(file, line);) {
-        std::string depfile;
-        std::istringstream ss(line);
-        if (isFirstLine) {
-            ss >> depfile;
-            isFirstLine = false;
+    auto offsets = std::vector<std::pair<size_t, size_t>>{};
+    bool isTarget = true;
+
+    while (p < end) {
+        auto c = *p;
+
+        // Embedded null characters is treated as spaces, the scan of a path
+        // below would otherwise stop on it without advancing
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\0') {
+            ++p;
+            continue;
         }
-        bool foundBackslash = false;
-        for (std::string word; ss >> word;) {
-            if (word.back() == '\\') {
-                foundBackslash = true;
-                word.pop_back();
+        else if (isContinuation(p)) {
+            p += (p[1] == '\n') ? 2 : 3;
+            continue;
+        }
+        else if (c == '\n') {
+            if (!isTarget) {
+                break; // Only the first rule is used
             }
+            ++p;
+            continue;
+        }
+        else if (c == ':' && isTarget) {
+            isTarget = false;
+            ++p;
+            continue;
+        }
+
+        bool isAbsolute = (c == '/');
+        auto start = paths.size();
+        if (!isTarget && !isAbsolute) {
+            paths += "./";
+        }
+
+        for (;;) {
+            auto length = std::strcspn(p, " \t\r\n\\$:");
+            paths.append(p, length);
+            p += length;
 
-            else if (!word.empty()) {
-                if (word.front() != '/') {
-                    ret.deps.push_back("./" + word);
+            if (*p == '\\' && !isContinuation(p)) {
+                if (p[1] == ' ' || p[1] == '#') {
+                    paths.push_back(p[1]);
+                    p += 2;
                 }
+                else {
+                    paths.push_back('\\'); // Windows paths
+                    ++p;
+                }
+            }
+            else if (*p == '$') {
+                paths.push_back('$');
+                p += (p[1] == '$') ? 2 : 1;
+            }
+            else if (*p == ':' && !(isTarget && isSpace(p[1]))) {
+                paths.push_back(':'); // Eg a drive letter
+                ++p;
+            }
+            else {
+                break;
             }
         }
-        if (!foundBackslash) {
-            break;
+
+        if (*p == ':') {
+            // The end of the targets
+            isTarget = false;
+            ++p;
+            paths.resize(start);
+        }
+        else if (isTarget || isAbsolute) {
+            paths.resize(start);
         }
+        else {
+            offsets.emplace_back(start, paths.size() - start);
+        }
+    }
+
+    // The paths is not moved any more
+    content.deps.reserve(offsets.size());
+    for (auto &offset : offsets) {
+        content.deps.emplace_back(paths.data() + offset.first, offset.second);
     }
-    return ret;
+}
+
+//! Read and parse a depfile
+//! @return false if the file could not be read
+inline bool parseDepFile(const filesystem::path &path,
+                         DepFileContent &content) {
+    content.buffer.clear();
+    content.paths.clear();
+    content.deps.clear();
+
+    auto file = std::ifstream{path, std::ios::binary | std::ios::ate};
+
+    if (!file.is_open()) {
+        return false;
+    }
+
+    auto size = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+    content.buffer.resize(size);
+    if (!file.read(content.buffer.data(), static_cast<std::streamsize>(size))) {
+        return false;
+    }
+
+    parseDepFileBuffer(content);
+
+    return true;
 }
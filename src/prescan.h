@@ -1,8 +1,10 @@
 #pragma once
 
 #include "filesystem.h"
+#include "process.h"
 #include "processedcommand.h"
 #include "sourcetype.h"
+#include "statcache.h"
 #include "tasklist.h"
 #include "json/json.h"
 #include <iostream>
@@ -21,11 +23,14 @@ inline std::optional<PrescanResult> parsePrescanResults(
     filesystem::path jsonFile,
     filesystem::path source) {
 
-    if (!filesystem::exists(expandedFile) || !filesystem::exists(jsonFile)) {
+    auto &cache = statCache();
+    auto expandedStat = cache.stat(expandedFile);
+    auto jsonStat = cache.stat(jsonFile);
+
+    if (!expandedStat.exists || !jsonStat.exists) {
         return {}; // Not found -> create files
     }
-    else if (filesystem::last_write_time(jsonFile.string()) <
-             filesystem::last_write_time(source)) {
+    else if (jsonStat.mtime < cache.stat(source).mtime) {
         return {}; // Its old -> redo
     }
 
@@ -47,12 +52,11 @@ inline std::optional<PrescanResult> parsePrescanResults(
     if (auto f = json.find("include"); f != json.end()) {
         result.includes.reserve(f->size());
 
-        auto expandedTime = filesystem::last_write_time(expandedFile);
-
         for (auto &j : *f) {
             auto includeFilename = j.string();
-            auto includeTime = filesystem::last_write_time(includeFilename);
-            if (includeTime > expandedTime) {
+            // Headers are shared by many files and is only read once
+            auto include = cache.stat(includeFilename);
+            if (!include.exists || include.mtime > expandedStat.mtime) {
                 // One of the included headers is changed, the eem-file needs
                 // to be recreated
                 return {};
@@ -64,6 +68,25 @@ inline std::optional<PrescanResult> parsePrescanResults(
     return result;
 }
 
+//! The headers that was included the last time a file was prescanned
+inline std::vector<std::string> loadPrescanIncludes(
+    const filesystem::path &jsonFile) {
+    auto includes = std::vector<std::string>{};
+
+    if (!statCache().stat(jsonFile).exists) {
+        return includes;
+    }
+
+    const auto json = Json::LoadFile(jsonFile.string());
+    if (auto f = json.find("include"); f != json.end()) {
+        for (auto &j : *f) {
+            includes.push_back(j.string());
+        }
+    }
+
+    return includes;
+}
+
 //! Parse a expanded file and alse write result to the provide json path
 inline PrescanResult parseExpandedFile(filesystem::path expandedFile,
                                        filesystem::path jsonFile) {
@@ -163,14 +186,21 @@ inline PrescanResult parseExpandedFile(filesystem::path expandedFile,
     }
 
     std::ofstream{jsonFile} << json;
+    statCache().invalidate(jsonFile);
 
     return ret;
 }
 
+//! Where the result of prescanning the source of a expanded file is saved
+inline filesystem::path prescanResultPath(const Task &task) {
+    auto source = task.in().front()->out();
+    return task.dir() / (source.string() + ".json");
+}
+
 inline PrescanResult prescan(Task &task) {
     auto expandedFile = task.out();
     auto source = task.in().front()->out();
-    auto jsonFile = task.dir() / (source.string() + ".json");
+    auto jsonFile = prescanResultPath(task);
 
     if (auto p = parsePrescanResults(expandedFile, jsonFile, source); p) {
         return std::move(*p);
@@ -184,16 +214,21 @@ inline PrescanResult prescan(Task &task) {
     const bool shouldExpand = true;
 
     auto command =
-        ProcessedCommand{task.commandAt(shouldExpand ? "eem" : "copy")}.expand(
-            task);
+        ProcessedCommand::cached(task.commandAt(shouldExpand ? "eem" : "copy"))
+            .expand(task);
 
     std::cout << "prescanning with: " << command << "\n";
 
-    if (system(command.c_str())) {
+    auto result = runProcess(command);
+    statCache().invalidate(expandedFile);
+
+    std::cout << result.output;
+
+    if (result.status) {
         throw std::runtime_error{"failed to prescan " + task.out().string() +
                                  "\nwith command " + command};
     }
-    else if (!filesystem::exists(expandedFile)) {
+    else if (!statCache().stat(expandedFile).exists) {
 
         throw std::runtime_error{"could not find expanded file " +
                                  expandedFile.string()};
@@ -221,6 +256,18 @@ inline Task *getHeaderTask(TaskList &tasks, filesystem::path path) {
 inline void prescan(TaskList &tasks) {
     createDirectories(tasks);
 
+    {
+        auto paths = std::vector<filesystem::path>{};
+        for (auto &task : tasks) {
+            if (getType(task->out()) == SourceType::ExpandedModuleSource) {
+                paths.push_back(task->out());
+                paths.push_back(prescanResultPath(*task));
+                paths.push_back(task->in().front()->out());
+            }
+        }
+        statCache().prefetch(paths);
+    }
+
     std::vector<std::pair<Task *, std::string>> connections;
 
     for (auto &task : tasks) {
@@ -0,0 +1,324 @@
+#include "process.h"
+#include "os.h"
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#ifndef MATMAKE_USING_WINDOWS
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace {
+
+//! Characters that means something special to the shell when not quoted
+bool isShellCharacter(char c) {
+    switch (c) {
+    case '|':
+    case '&':
+    case ';':
+    case '<':
+    case '>':
+    case '(':
+    case ')':
+    case '$':
+    case '`':
+    case '*':
+    case '?':
+    case '[':
+    case '\n':
+        return true;
+    default:
+        return false;
+    }
+}
+
+#ifndef MATMAKE_USING_WINDOWS
+
+int decodeStatus(int status) {
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    else if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
+}
+
+ProcessResult spawnProcess(const std::vector<std::string> &args,
+                           std::string buffer,
+                           ProcessGroups *groups,
+                           ProcessOutput output) {
+    auto result = ProcessResult{};
+    result.output = std::move(buffer);
+    result.output.clear();
+
+    bool shouldCapture = output == ProcessOutput::Capture;
+
+    int pipeFds[2] = {-1, -1};
+    // Close on exec so that processes started from other threads does not
+    // inherit the pipe and keep it open
+    if (shouldCapture && pipe2(pipeFds, O_CLOEXEC)) {
+        result.status = 1;
+        result.output = "could not create pipe: " +
+                        std::string{std::strerror(errno)} + "\n";
+        return result;
+    }
+
+    auto argv = std::vector<char *>{};
+    argv.reserve(args.size() + 1);
+    for (auto &arg : args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (shouldCapture) {
+        posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDERR_FILENO);
+    }
+
+    // The coordinator blocks signals in its threads, do not pass that on
+    posix_spawnattr_t attributes;
+    posix_spawnattr_init(&attributes);
+    short flags = POSIX_SPAWN_SETSIGMASK;
+    sigset_t mask;
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attributes, &mask);
+    if (groups) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attributes, 0);
+    }
+    posix_spawnattr_setflags(&attributes, flags);
+
+    pid_t pid = 0;
+    auto error = posix_spawnp(
+        &pid, argv.front(), &actions, &attributes, argv.data(), environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attributes);
+    if (shouldCapture) {
+        close(pipeFds[1]);
+    }
+
+    if (error) {
+        if (shouldCapture) {
+            close(pipeFds[0]);
+        }
+        result.status = 127;
+        result.output = "could not start " + args.front() + ": " +
+                        std::strerror(error) + "\n";
+        return result;
+    }
+
+    result.pid = pid;
+
+    if (groups) {
+        groups->add(pid);
+    }
+
+    if (shouldCapture) {
+        char readBuffer[4096];
+        for (;;) {
+            auto size = read(pipeFds[0], readBuffer, sizeof(readBuffer));
+            if (size > 0) {
+                result.output.append(readBuffer, static_cast<size_t>(size));
+            }
+            else if (size < 0 && errno == EINTR) {
+                continue;
+            }
+            else {
+                break;
+            }
+        }
+
+        close(pipeFds[0]);
+    }
+
+    if (groups) {
+        // Wait without reaping the process so that the pid can not be reused
+        // while it can still be signaled
+        auto info = siginfo_t{};
+        auto id = static_cast<id_t>(pid);
+        while (waitid(P_PID, id, &info, WEXITED | WNOWAIT) < 0) {
+            if (errno != EINTR) {
+                break;
+            }
+        }
+        groups->remove(pid);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            result.status = 1;
+            return result;
+        }
+    }
+
+    result.status = decodeStatus(status);
+
+    return result;
+}
+
+#endif
+
+} // namespace
+
+void ProcessGroups::add(int pid) {
+    auto lock = std::scoped_lock{_mutex};
+    _pids.insert(pid);
+#ifndef MATMAKE_USING_WINDOWS
+    if (_isStopped) {
+        kill(-pid, SIGTERM);
+    }
+#endif
+}
+
+void ProcessGroups::remove(int pid) {
+    auto lock = std::scoped_lock{_mutex};
+    _pids.erase(pid);
+}
+
+void ProcessGroups::stop(std::chrono::milliseconds gracePeriod) {
+    using namespace std::chrono_literals;
+
+#ifndef MATMAKE_USING_WINDOWS
+    {
+        auto lock = std::scoped_lock{_mutex};
+        _isStopped = true;
+        for (auto pid : _pids) {
+            kill(-pid, SIGTERM);
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + gracePeriod;
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            auto lock = std::scoped_lock{_mutex};
+            if (_pids.empty()) {
+                return;
+            }
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+
+    auto lock = std::scoped_lock{_mutex};
+    for (auto pid : _pids) {
+        kill(-pid, SIGKILL);
+    }
+#endif
+}
+
+bool splitCommand(std::string_view command, std::vector<std::string> &args) {
+    args.clear();
+
+    auto arg = std::string{};
+    bool hasArg = false; // To handle empty strings like ""
+
+    auto finishArg = [&] {
+        if (hasArg) {
+            args.push_back(std::move(arg));
+            arg.clear();
+            hasArg = false;
+        }
+    };
+
+    for (size_t i = 0; i < command.size(); ++i) {
+        auto c = command[i];
+
+        if (c == ' ' || c == '\t') {
+            finishArg();
+        }
+        else if (c == '\'') {
+            auto end = command.find('\'', i + 1);
+            if (end == std::string_view::npos) {
+                return false;
+            }
+            arg.append(command.substr(i + 1, end - i - 1));
+            hasArg = true;
+            i = end;
+        }
+        else if (c == '"') {
+            for (++i;; ++i) {
+                if (i >= command.size()) {
+                    return false;
+                }
+                c = command[i];
+                if (c == '"') {
+                    break;
+                }
+                else if (c == '$' || c == '`') {
+                    return false;
+                }
+                else if (c == '\\' && i + 1 < command.size() &&
+                         std::strchr("\"\\$`", command[i + 1])) {
+                    ++i;
+                    arg.push_back(command[i]);
+                }
+                else {
+                    arg.push_back(c);
+                }
+            }
+            hasArg = true;
+        }
+        else if (c == '\\') {
+            if (i + 1 >= command.size() || command[i + 1] == '\n') {
+                return false;
+            }
+            ++i;
+            arg.push_back(command[i]);
+            hasArg = true;
+        }
+        else if (isShellCharacter(c)) {
+            return false;
+        }
+        else if (!hasArg && (c == '#' || c == '~')) {
+            // Comments and home directory expansion
+            return false;
+        }
+        else if (c == '=' && args.empty()) {
+            // Environment variable assignment in front of the command
+            return false;
+        }
+        else {
+            arg.push_back(c);
+            hasArg = true;
+        }
+    }
+
+    finishArg();
+
+    return true;
+}
+
+ProcessResult runProcess(const std::string &command,
+                         std::string buffer,
+                         ProcessGroups *groups,
+                         ProcessOutput output) {
+#ifdef MATMAKE_USING_WINDOWS
+    auto result = ProcessResult{};
+    result.output = std::move(buffer);
+    result.output.clear();
+    result.status = std::system(command.c_str());
+    return result;
+#else
+    auto args = std::vector<std::string>{};
+
+    if (!splitCommand(command, args)) {
+        args = {"/bin/sh", "-c", command};
+    }
+
+    if (args.empty()) {
+        return {};
+    }
+
+    return spawnProcess(args, std::move(buffer), groups, output);
+#endif
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ProcessResult {
+    int status = 0; // Exit status of the process, 0 on success
+    int pid = 0;
+    std::string output; // Both stdout and stderr
+};
+
+enum class ProcessOutput {
+    Capture, // Stdout and stderr is stored in ProcessResult::output
+    Inherit, // The process writes directly to the terminal
+};
+
+//! Keeps track of running processes so that they can be stopped from another
+//! thread. Each process is started in its own process group so that
+//! processes started by the commands (eg the compiler driver's cc1plus) are
+//! stopped too
+class ProcessGroups {
+public:
+    //! Register a started process. Stops it right away if stop() has been
+    //! called already
+    void add(int pid);
+
+    //! Must be called before the process is reaped, so that a reused pid is
+    //! never signaled
+    void remove(int pid);
+
+    //! Send SIGTERM to all running process groups, and SIGKILL to the ones
+    //! that is still running after the grace period
+    void stop(std::chrono::milliseconds gracePeriod);
+
+private:
+    std::mutex _mutex;
+    std::set<int> _pids;
+    bool _isStopped = false;
+};
+
+//! Split a command into arguments the same way as a posix shell would do for
+//! simple commands
+//! @return false if the command contains redirections, pipes, variables or
+//!         other syntax that requires a real shell
+bool splitCommand(std::string_view command, std::vector<std::string> &args);
+
+//! Run a command and wait for it to finish
+//! The process is started directly if possible and only started through the
+//! shell if the command requires it
+//! @param buffer storage that is reused for the output to avoid allocations
+//! @param groups if not null the process is started in a new process group
+//!               and registered so that it can be stopped
+//! @param output if the output is captured or written by the process itself
+ProcessResult runProcess(const std::string &command,
+                         std::string buffer = {},
+                         ProcessGroups *groups = nullptr,
+                         ProcessOutput output = ProcessOutput::Capture);
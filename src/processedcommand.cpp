@@ -0,0 +1,101 @@
+#include "processedcommand.h"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+constexpr auto parentPrefix = std::string_view{"parent."};
+
+struct CommandCache {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<ProcessedCommand>>
+        commands;
+};
+
+CommandCache &commandCache() {
+    static auto cache = CommandCache{};
+    return cache;
+}
+
+} // namespace
+
+CommandProperty commandProperty(std::string_view name) {
+    if (name.empty()) {
+        return CommandProperty::Unknown;
+    }
+    if (name.front() == '.') {
+        return CommandProperty::Extension;
+    }
+
+    static const auto properties =
+        std::unordered_map<std::string_view, CommandProperty>{
+            {"command", CommandProperty::Command},
+            {"out", CommandProperty::Out},
+            {"dir", CommandProperty::Dir},
+            {"depfile", CommandProperty::Depfile},
+            {"in", CommandProperty::In},
+            {"src", CommandProperty::Src},
+            {"c++", CommandProperty::Cxx},
+            {"cc", CommandProperty::Cc},
+            {"static", CommandProperty::Ar},
+            {"ar", CommandProperty::Ar},
+            {"flags", CommandProperty::Flags},
+            {"ldflags", CommandProperty::Ldflags},
+            {"eflags", CommandProperty::Eflags},
+            {"modules", CommandProperty::Modules},
+            {"includes", CommandProperty::Includes},
+            {"standard", CommandProperty::Standard},
+        };
+
+    if (auto f = properties.find(name); f != properties.end()) {
+        return f->second;
+    }
+    return CommandProperty::Unknown;
+}
+
+ProcessedCommand::ProcessedCommand(std::string_view command) {
+    auto pushText = [this](std::string_view text) {
+        if (!text.empty()) {
+            _segments.push_back({std::string{text}});
+        }
+    };
+
+    auto old = size_t{0};
+
+    for (size_t f; (f = command.find('{', old)) != std::string_view::npos;) {
+        auto end = command.find('}', f);
+        if (end == std::string_view::npos) {
+            break; // The rest is kept as text
+        }
+
+        pushText(command.substr(old, f - old));
+
+        auto name = command.substr(f + 1, end - f - 1);
+        auto segment = Segment{};
+        segment.isReference = true;
+        while (name.substr(0, parentPrefix.size()) == parentPrefix) {
+            name.remove_prefix(parentPrefix.size());
+            ++segment.numParents;
+        }
+        segment.property = commandProperty(name);
+        if (segment.property == CommandProperty::Extension) {
+            segment.value = name;
+        }
+        _segments.push_back(std::move(segment));
+
+        old = end + 1;
+    }
+
+    pushText(command.substr(old));
+}
+
+const ProcessedCommand &ProcessedCommand::cached(const std::string &command) {
+    auto &cache = commandCache();
+    auto lock = std::scoped_lock{cache.mutex};
+    auto &processed = cache.commands[command];
+    if (!processed) {
+        processed = std::make_unique<ProcessedCommand>(command);
+    }
+    return *processed;
+}
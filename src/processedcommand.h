@@ -1,60 +1,87 @@
 #pragma once
 
-#include <map>
-#include <sstream>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
+//! The properties that can be referenced with "{name}" in commands
+enum class CommandProperty : uint8_t {
+    Unknown, // Expands to nothing
+    Extension, // Eg "{.exe}", depends on the flag style
+    Command,
+    Out,
+    Dir,
+    Depfile,
+    In,
+    Src,
+    Cxx,
+    Cc,
+    Ar,
+    Flags,
+    Ldflags,
+    Eflags,
+    Modules,
+    Includes,
+    Standard,
+};
+
+//! Translate the name used in commands, without "parent." prefixes
+CommandProperty commandProperty(std::string_view name);
+
+//! A command template that is split into text and references to properties
+//! when it is created, so that it can be expanded for many tasks without
+//! parsing it again
 class ProcessedCommand {
 public:
-    ProcessedCommand(std::string command) {
-        auto f = size_t{0};
-        auto old = size_t{0};
-
-        while ((f = command.find('{', old)) != std::string::npos) {
-            segments.push_back({
-                command.substr(old, f - old),
-                false,
-            });
-
-            if ((old = command.find('}', f)) != std::string::npos) {
-                segments.push_back({
-                    command.substr(f + 1, old - f - 1),
-                    true,
-                });
-                ++old;
-            }
-            else {
-                break;
-            }
-        }
-    }
+    struct Segment {
+        std::string value; // Text, or the name of the extension
+        CommandProperty property = CommandProperty::Unknown;
+        bool isReference = false;
+        uint8_t numParents = 0; // Number of "parent." before the name
+    };
+
+    ProcessedCommand(std::string_view command);
     ProcessedCommand(const ProcessedCommand &) = default;
     ProcessedCommand(ProcessedCommand &&) = default;
     ProcessedCommand &operator=(const ProcessedCommand &) = default;
     ProcessedCommand &operator=(ProcessedCommand &&) = default;
 
+    //! Get the parsed version of a command, every distinct command is only
+    //! parsed once. The reference is valid for the rest of the program
+    //! Thread safe
+    static const ProcessedCommand &cached(const std::string &command);
+
+    //! Append the command with all references replaced to the buffer
     template <class T>
-    std::string expand(const T &task) {
-        std::ostringstream ss;
+    void expand(const T &task, std::string &buffer) const {
+        for (auto &s : _segments) {
+            if (!s.isReference) {
+                buffer += s.value;
+                continue;
+            }
 
-        for (auto s : segments) {
-            if (s.isReference) {
-                ss << task.property(s.value);
+            auto t = &task;
+            for (size_t i = 0; t && i < s.numParents; ++i) {
+                t = t->parent();
             }
-            else {
-                ss << s.value;
+            if (t) {
+                t->appendProperty(buffer, s.property, s.value);
             }
         }
+    }
 
-        return ss.str();
+    template <class T>
+    std::string expand(const T &task) const {
+        auto buffer = std::string{};
+        expand(task, buffer);
+        return buffer;
     }
 
-private:
-    struct Segment {
-        std::string value;
-        bool isReference = false;
-    };
+    const std::vector<Segment> &segments() const {
+        return _segments;
+    }
 
-    std::vector<Segment> segments;
+private:
+    std::vector<Segment> _segments;
 };
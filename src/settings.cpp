@@ -16,12 +16,22 @@ options:
 --verbose -v          print extra information
 -C [dir]              run in another directory
 -j                    set number of worker threads
+-k [n]                keep going until n tasks has failed (0 = never stop)
+--max-load [n]        do not start new tasks when the load average is above n
+--min-memory [mb]     do not start new tasks when less memory is available
+--restat              do not rebuild tasks whose inputs was rebuilt without
+                      changes (native backend)
+--watch               keep the build in memory and rebuild when source files
+                      changes. Other native builds of the same target is
+                      sent to the running process
 --backend -b          what build backend to use (ninja, native or makefile)
 --target -t [target]  select target (eg gcc, clang, msvc + gcc-debug etc)
 --clean               remove all built file
 --list                list available targets
 --test                run all targets marked with [test]
 --compile-commands    output clang compile commands.json
+--stats [n]           print the slowest tasks of the last n native builds
+--trace [file]        save a chrome trace of a native build to file
 --msvc-wine           setup msvc paths in wine to run in linux
 
 developer options:
@@ -136,6 +146,24 @@ Settings::Settings(int argc, char **argv) {
             ++i;
             numThreads = toI(args.at(i));
         }
+        else if (arg == "-k") {
+            ++i;
+            maxFailures = toI(args.at(i));
+        }
+        else if (arg == "--max-load") {
+            ++i;
+            std::istringstream{args.at(i)} >> maxLoad;
+        }
+        else if (arg == "--min-memory") {
+            ++i;
+            minMemory = toI(args.at(i));
+        }
+        else if (arg == "--restat") {
+            restat = true;
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
         else if (arg == "--dry-run") {
             skipBuild = true;
         }
@@ -159,6 +187,18 @@ Settings::Settings(int argc, char **argv) {
         else if (arg == "--test") {
             command = Command::BuildAndTest;
         }
+        else if (arg == "--stats") {
+            command = Command::Stats;
+            if (i + 1 < args.size() && !args.at(i + 1).empty() &&
+                isdigit(args.at(i + 1).front())) {
+                ++i;
+                numStatsBuilds = toI(args.at(i));
+            }
+        }
+        else if (arg == "--trace") {
+            ++i;
+            traceFile = args.at(i);
+        }
         else if (arg == "--compile-commands") {
             outputCompileCommands = true;
         }
@@ -188,6 +228,10 @@ Settings::Settings(int argc, char **argv) {
         numThreads = std::thread::hardware_concurrency();
     }
 
+    if (watch) {
+        backend = Backend::Native;
+    }
+
     if (backend == Backend::Default) {
         backend = defaultBackend();
     }
@@ -9,6 +9,7 @@ enum class Command {
     ParseTasks,
     Clean,
     List,
+    Stats,
 };
 
 enum class Backend {
@@ -27,8 +28,15 @@ struct Settings {
     bool skipBuild = false;
     bool outputCompileCommands = false;
     bool useMsvcEnvironment = false;
+    bool restat = false; // Skip tasks whose inputs was rebuilt unchanged
+    bool watch = false;  // Keep running and rebuild when files is changed
     std::string target = "";
     size_t numThreads = 0;
+    size_t maxFailures = 1; // Keep going until this many tasks fails, 0 = inf
+    double maxLoad = 0;   // Do not start new tasks above this load, 0 = off
+    size_t minMemory = 0; // Free memory in MB required to start new tasks
+    size_t numStatsBuilds = 10;
+    filesystem::path traceFile; // Chrome trace output for native builds
     Backend backend = Backend::Default;
 
     Command command = Command::Build;
@@ -0,0 +1,160 @@
+#include "statcache.h"
+#include "os.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#ifndef MATMAKE_USING_WINDOWS
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+#ifndef MATMAKE_USING_WINDOWS
+
+filesystem::file_time_type::duration toDuration(int64_t seconds,
+                                                int64_t nanoseconds) {
+    return std::chrono::duration_cast<filesystem::file_time_type::duration>(
+        std::chrono::seconds{seconds} + std::chrono::nanoseconds{nanoseconds});
+}
+
+//! The epoch of file_time_type is implementation defined. last_write_time()
+//! is implemented with stat() so the difference for the same file is exact
+filesystem::file_time_type::duration calculateEpochOffset() {
+    struct stat buffer;
+    if (::stat("/", &buffer)) {
+        return {};
+    }
+    auto time = filesystem::last_write_time("/");
+    return time.time_since_epoch() -
+           toDuration(buffer.st_mtim.tv_sec, buffer.st_mtim.tv_nsec);
+}
+
+filesystem::file_time_type toFileTime(int64_t seconds, int64_t nanoseconds) {
+    static const auto offset = calculateEpochOffset();
+    return filesystem::file_time_type{toDuration(seconds, nanoseconds) +
+                                      offset};
+}
+
+#endif
+
+FileStat readStat(const std::string &path) {
+    auto stat = FileStat{};
+
+#if defined(MATMAKE_USING_WINDOWS)
+    auto ec = std::error_code{};
+    auto status = filesystem::status(path, ec);
+    if (ec || !filesystem::exists(status)) {
+        return stat;
+    }
+    stat.exists = true;
+    stat.isDirectory = filesystem::is_directory(status);
+    stat.mtime = filesystem::last_write_time(path, ec);
+#elif defined(STATX_TYPE)
+    // statx only asks for the fields that is needed
+    struct statx buffer;
+    if (statx(AT_FDCWD,
+              path.c_str(),
+              AT_STATX_SYNC_AS_STAT,
+              STATX_TYPE | STATX_MTIME,
+              &buffer)) {
+        return stat;
+    }
+    stat.exists = true;
+    stat.isDirectory = S_ISDIR(buffer.stx_mode);
+    stat.mtime = toFileTime(buffer.stx_mtime.tv_sec, buffer.stx_mtime.tv_nsec);
+#else
+    struct stat buffer;
+    if (::stat(path.c_str(), &buffer)) {
+        return stat;
+    }
+    stat.exists = true;
+    stat.isDirectory = S_ISDIR(buffer.st_mode);
+    stat.mtime = toFileTime(buffer.st_mtim.tv_sec, buffer.st_mtim.tv_nsec);
+#endif
+
+    return stat;
+}
+
+} // namespace
+
+FileStat StatCache::stat(const filesystem::path &path) {
+    auto key = path.string();
+
+    {
+        auto lock = std::scoped_lock{_mutex};
+        if (auto f = _files.find(key); f != _files.end()) {
+            return f->second;
+        }
+    }
+
+    auto stat = readStat(key);
+
+    auto lock = std::scoped_lock{_mutex};
+    _files[std::move(key)] = stat;
+    return stat;
+}
+
+void StatCache::prefetch(const std::vector<filesystem::path> &paths) {
+    auto missing = std::vector<std::string>{};
+
+    {
+        auto lock = std::scoped_lock{_mutex};
+        for (auto &path : paths) {
+            auto key = path.string();
+            if (!_files.count(key)) {
+                missing.push_back(std::move(key));
+            }
+        }
+    }
+
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+    auto stats = std::vector<FileStat>(missing.size());
+
+    // The threads mostly waits for the file system, use more than the number
+    // of cores
+    constexpr size_t filesPerThread = 64;
+    auto numThreads = std::min<size_t>(
+        missing.size() / filesPerThread,
+        std::max<size_t>(std::thread::hardware_concurrency(), 1) * 4);
+
+    auto next = std::atomic_size_t{0};
+    auto work = [&] {
+        for (size_t i; (i = next++) < missing.size();) {
+            stats.at(i) = readStat(missing.at(i));
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (size_t i = 1; i < numThreads; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    auto lock = std::scoped_lock{_mutex};
+    for (size_t i = 0; i < missing.size(); ++i) {
+        _files[std::move(missing.at(i))] = stats.at(i);
+    }
+}
+
+void StatCache::invalidate(const filesystem::path &path) {
+    auto lock = std::scoped_lock{_mutex};
+    _files.erase(path.string());
+}
+
+void StatCache::clear() {
+    auto lock = std::scoped_lock{_mutex};
+    _files.clear();
+}
+
+StatCache &statCache() {
+    static auto cache = StatCache{};
+    return cache;
+}
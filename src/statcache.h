@@ -0,0 +1,40 @@
+#pragma once
+
+#include "filesystem.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct FileStat {
+    bool exists = false;
+    bool isDirectory = false;
+    filesystem::file_time_type mtime = {};
+};
+
+//! Metadata of files that is shared by everything that checks if files exists
+//! or is up to date, so that each file is only checked once per run
+//! Paths are used as they are written, eg "./src/main.cpp" and "src/main.cpp"
+//! is different entries
+class StatCache {
+public:
+    //! Get the metadata of a file, only the first call for each path reads
+    //! from the file system. Thread safe
+    FileStat stat(const filesystem::path &path);
+
+    //! Read the metadata of many files in parallel, on network file systems
+    //! this is much faster than doing it one by one
+    void prefetch(const std::vector<filesystem::path> &paths);
+
+    //! Read the file again the next time, used when a file is written
+    void invalidate(const filesystem::path &path);
+
+    void clear();
+
+private:
+    std::mutex _mutex;
+    std::unordered_map<std::string, FileStat> _files;
+};
+
+//! The cache for this run
+StatCache &statCache();
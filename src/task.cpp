@@ -1,4 +1,5 @@
 #include "task.h"
+#include "binary.h"
 #include "json/json.h"
 #include <iostream>
 
@@ -9,6 +10,7 @@ const std::vector<std::string> stateMap = {
     "DirtyReady",
     "DirtyWaiting",
     "Done",
+    "Failed",
 };
 
 void Task::parse(const Json &jtask) {
@@ -40,6 +42,16 @@ void Task::parse(const Json &jtask) {
             this->commands(std::move(commands));
         }
     }
+    if (auto f = jsonFind("pools")) {
+        if (f->type == Json::Object) {
+            std::map<std::string, size_t> pools;
+            for (auto &child : *f) {
+                pools[child.name] = std::stoul(child.value);
+            }
+
+            this->pools(std::move(pools));
+        }
+    }
     if (auto f = jsonFind("dir")) {
         dir(BuildLocation::Real, f->string());
     }
@@ -75,6 +87,32 @@ void Task::parse(const Json &jtask) {
     }
 }
 
+void Task::writeBinary(BinaryWriter &writer) const {
+    writer.string(_name);
+    writer.string(_out.string());
+    for (auto &dir : _dir) {
+        writer.string(dir.str());
+    }
+    writer.string(_depfile.str());
+    writer.string(_command.str());
+    writer.value(_flagStyle);
+    writer.value(_buildLocation);
+}
+
+void Task::readBinary(BinaryReader &reader) {
+    _name = reader.string();
+    _out = reader.string();
+    for (auto &dir : _dir) {
+        dir = reader.string();
+    }
+    _depfile = reader.string();
+    command(std::string{reader.string()}); // Also sets shouldLinkFile
+    _flagStyle = reader.value<FlagStyle>();
+    _buildLocation = reader.value<BuildLocation>();
+    recordChange();
+    ++_generation;
+}
+
 Json Task::dump() {
     auto json = Json{};
 
@@ -86,16 +124,18 @@ Json Task::dump() {
 
     attachValue("name", _name);
     attachValue("out", _out.string());
-    attachValue("dir", _dir.front().string());
-    attachValue("objdir", _dir.back().string());
-    attachValue("depfile", _depfile.string());
-    attachValue("command", _command);
-    attachValue("cxx", _cxx.string());
-    attachValue("cc", _cc.string());
-    attachValue("flags", _flags);
-    attachValue("ldflags", _ldflags);
-    attachValue("eflags", _ldflags);
-    attachValue("depprefix", _depprefix);
+    auto &properties = this->properties();
+
+    attachValue("dir", _dir.front().str());
+    attachValue("objdir", _dir.back().str());
+    attachValue("depfile", _depfile.str());
+    attachValue("command", _command.str());
+    attachValue("cxx", properties.cxx.str());
+    attachValue("cc", properties.cc.str());
+    attachValue("flags", properties.flags.str());
+    attachValue("ldflags", properties.ldflags.str());
+    attachValue("eflags", properties.eflags.str());
+    attachValue("depprefix", properties.depprefix.str());
 
     if (!_in.empty()) {
         auto &j = json["in"];
@@ -113,13 +153,13 @@ Json Task::dump() {
         }
     }
 
-    if (!_config.empty()) {
-        json["config"].vector(_config);
+    if (!properties.config.empty()) {
+        json["config"].vector(properties.config);
     }
 
-    if (!_commands.empty()) {
+    if (!properties.commands.empty()) {
         auto &c = json["commands"];
-        for (auto &command : _commands) {
+        for (auto &command : properties.commands) {
             c[command.first] = command.second;
         }
     }
@@ -144,7 +184,8 @@ void Task::print(bool verbose, size_t indentation) {
                 auto command = this->command();
                 indent();
                 std::cout << "command: "
-                          << ProcessedCommand{command}.expand(*this) << "\n";
+                          << ProcessedCommand::cached(command).expand(*this)
+                          << "\n";
 
                 indent();
                 std::cout << "raw: " << command << "\n";
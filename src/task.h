@@ -1,15 +1,20 @@
 ﻿#pragma once
 
 #include "filesystem.h"
+#include "internedstring.h"
 #include "processedcommand.h"
 #include "sourcetype.h"
+#include "statcache.h"
 #include "translateconfig.h"
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum class TaskState {
@@ -19,6 +24,7 @@ enum class TaskState {
     DirtyReady,
     DirtyWaiting,
     Done,
+    Failed, // The task or one of its dependencies failed to build
 };
 
 inline std::string join(std::string a, std::string b) {
@@ -39,6 +45,59 @@ enum class BuildLocation : size_t {
     Inherit, // Select depending on target
 };
 
+//! Settings that is only set on a few tasks, eg the tasks created from
+//! Matmakefile nodes. The tasks for each file does not set any of them and only
+//! stores a null pointer. Equal blocks can be shared between tasks
+struct TaskProperties {
+    InternedString cxx;
+    InternedString cc;
+    InternedString ar;
+    InternedString flags;
+    InternedString ldflags;
+    InternedString eflags;
+    InternedString depprefix;
+    std::vector<std::string> includes;
+    std::vector<std::string> sysIncludes;
+    std::vector<std::string> config;
+    std::map<std::string, std::string> commands; // Parents build command
+    std::map<std::string, size_t> pools;
+
+    bool operator==(const TaskProperties &other) const {
+        return cxx == other.cxx && cc == other.cc && ar == other.ar &&
+               flags == other.flags && ldflags == other.ldflags &&
+               eflags == other.eflags && depprefix == other.depprefix &&
+               includes == other.includes &&
+               sysIncludes == other.sysIncludes && config == other.config &&
+               commands == other.commands && pools == other.pools;
+    }
+};
+
+//! Inherited properties resolved through the parents, see
+//! Task::resolveProperties()
+struct ResolvedTaskProperties {
+    filesystem::path out;
+    InternedString dir;
+    InternedString command;
+    InternedString cxx;
+    InternedString cc;
+    InternedString ar;
+    InternedString flags;
+    InternedString ldflags;
+    InternedString eflags;
+    InternedString depprefix;
+    InternedString includes;
+    InternedString config;
+    InternedString standard;
+    FlagStyle flagStyle = FlagStyle::Inherit;
+    bool hasCommand = false;
+
+    // Used to know when the values is out of date
+    const class Task *parent = nullptr;
+    size_t generation = 0;
+    size_t stamp = 0;
+    size_t parentStamp = 0;
+};
+
 class Task {
 public:
     using TimePoint = filesystem::file_time_type;
@@ -63,13 +122,19 @@ public:
 
     void name(std::string value) {
         _name = std::move(value);
+        recordChange();
     }
 
     void name(std::string_view name) {
         _name = name;
+        recordChange();
     }
 
     filesystem::path out() const {
+        if (isResolved()) {
+            return _resolved.out;
+        }
+
         if (_out.empty()) {
             return {};
         }
@@ -78,7 +143,7 @@ public:
         }
         else {
             auto path = dir() / _out;
-            auto ext = extensionFromCommandType(_command, flagStyle());
+            auto ext = extensionFromCommandType(_command.str(), flagStyle());
             if (!ext.empty()) {
                 path.replace_extension(ext);
             }
@@ -92,6 +157,8 @@ public:
 
     void out(filesystem::path path) {
         _out = path;
+        recordChange();
+        ++_generation;
     }
 
     void pushIn(Task *in) {
@@ -154,6 +221,14 @@ public:
     }
 
     void parent(Task *parent) {
+        // Paths starting with "." does not depend on the parent. Headers is
+        // connected to many parents when depfiles is read
+        if (_parent != parent && !_out.empty() && *_out.begin() != ".") {
+            recordChange();
+        }
+        if (_parent != parent) {
+            ++_generation;
+        }
         _parent = parent;
     }
 
@@ -165,6 +240,29 @@ public:
         return _parent;
     }
 
+    //! Position in the task list that owns the task, so that data about
+    //! tasks can be kept in arrays instead of maps
+    uint32_t index() const {
+        return _index;
+    }
+
+    void index(uint32_t value) {
+        _index = value;
+    }
+
+    //! Where the task records that its name() or out(), or out() of the tasks
+    //! below it, can have changed. Set by TaskList to keep its lookup tables
+    //! up to date
+    void changeLog(std::vector<Task *> *log) {
+        _changeLog = log;
+        _isChangeRecorded = false;
+    }
+
+    //! Called by TaskList when the change is handled
+    void clearChange() {
+        _isChangeRecorded = false;
+    }
+
     //! Find the originating source file for this file
     //! This is assumed to be run on ".o" files so that there is no ambiguity
     Task *findSource() {
@@ -180,7 +278,9 @@ public:
     }
 
     void dir(BuildLocation loc, filesystem::path dir) {
-        _dir.at(static_cast<size_t>(loc)) = dir;
+        _dir.at(static_cast<size_t>(loc)) = dir.string();
+        recordChange();
+        ++_generation;
     }
 
     //! Returns the output path
@@ -188,13 +288,17 @@ public:
     //! chosen when traversing the tree
     //! External users should not specify the variable loc
     filesystem::path dir(BuildLocation loc = BuildLocation::Inherit) const {
+        if (loc == BuildLocation::Inherit && isResolved()) {
+            return _resolved.dir.str();
+        }
+
         if (loc == BuildLocation::Inherit) {
             loc = _buildLocation;
         }
 
         auto dir = [this, loc] {
             if (loc == BuildLocation::Real) {
-                return _dir.front();
+                return filesystem::path{_dir.front().str()};
             }
 
             auto &dir =
@@ -202,10 +306,10 @@ public:
 
             // If no intermediate location exist, just use the real instead
             if (dir.empty()) {
-                return _dir.front();
+                return filesystem::path{_dir.front().str()};
             }
 
-            return dir;
+            return filesystem::path{dir.str()};
         }();
 
         if (_parent) {
@@ -221,75 +325,107 @@ public:
 
     void buildLocation(BuildLocation value) {
         _buildLocation = value;
+        recordChange();
+        ++_generation;
     }
 
+    //! The value of "{name}" in a command
     std::string property(std::string name) const {
-        if (name.empty()) {
-            return {};
-        }
-        if (name.rfind("parent.") == 0) {
-            if (_parent) {
-                return _parent->property(name.substr(7));
+        return ProcessedCommand{"{" + name + "}"}.expand(*this);
+    }
+
+    //! Append the value of a property referenced in a command
+    //! @param extension the name of the extension for
+    //!        CommandProperty::Extension
+    void appendProperty(std::string &buffer,
+                        CommandProperty property,
+                        std::string_view extension = {}) const {
+        // Resolved values is appended without copying them first
+        auto append = [&](const InternedString &resolved, auto get) {
+            if (isResolved()) {
+                buffer += resolved.str();
             }
-        }
-        else if (name.front() == '.') {
-            return ::extension(name, flagStyle());
-        }
-        else if (name == "command") {
-            return _command;
-        }
-        else if (name == "out") {
-            return out().string();
-        }
-        else if (name == "dir") {
-            return dir().string();
-        }
-        else if (name == "depfile") {
-            auto d = depfile().string();
-            if (!d.empty()) {
-                return depprefix() + d;
+            else {
+                buffer += get();
             }
-        }
-        else if (name == "in") {
-            return concatIn();
-        }
-        else if (name == "src") {
+        };
+
+        switch (property) {
+        case CommandProperty::Unknown:
+            break;
+        case CommandProperty::Extension:
+            buffer += ::extension(std::string{extension}, flagStyle());
+            break;
+        case CommandProperty::Command:
+            buffer += _command.str();
+            break;
+        case CommandProperty::Out:
+            buffer += out().string();
+            break;
+        case CommandProperty::Dir:
+            append(_resolved.dir, [this] { return dir().string(); });
+            break;
+        case CommandProperty::Depfile:
+            if (!_depfile.empty()) {
+                append(_resolved.depprefix, [this] { return depprefix(); });
+                buffer += depfile().string();
+            }
+            break;
+        case CommandProperty::In:
+            buffer += concatIn();
+            break;
+        case CommandProperty::Src:
             if (!_in.empty()) {
-                return _in.front()->out().string();
+                buffer += _in.front()->out().string();
             }
+            break;
+        case CommandProperty::Cxx:
+            append(_resolved.cxx, [this] { return cxx().string(); });
+            break;
+        case CommandProperty::Cc:
+            append(_resolved.cc, [this] { return cc().string(); });
+            break;
+        case CommandProperty::Ar:
+            append(_resolved.ar, [this] { return ar().string(); });
+            break;
+        case CommandProperty::Flags:
+            if (isResolved()) {
+                auto &flags = _resolved.flags.str();
+                auto &config = _resolved.config.str();
+                buffer += flags;
+                if (!flags.empty() && !config.empty()) {
+                    buffer += ' ';
+                }
+                buffer += config;
+            }
+            else {
+                buffer += join(flags(), config());
+            }
+            break;
+        case CommandProperty::Ldflags:
+            append(_resolved.ldflags, [this] { return ldflags(); });
+            break;
+        case CommandProperty::Eflags:
+            append(_resolved.eflags, [this] { return eflags(); });
+            break;
+        case CommandProperty::Modules:
+            buffer += modulesString();
+            break;
+        case CommandProperty::Includes:
+            append(_resolved.includes, [this] { return includes(); });
+            break;
+        case CommandProperty::Standard:
+            append(_resolved.standard, [this] { return standard(); });
+            break;
         }
-        else if (name == "c++") {
-            return cxx().string();
-        }
-        else if (name == "cc") {
-            return cc().string();
-        }
-        else if (name == "static" || name == "ar") {
-            return ar().string();
-        }
-        else if (name == "flags") {
-            return join(flags(), config());
-        }
-        else if (name == "ldflags") {
-            return ldflags();
-        }
-        else if (name == "eflags") {
-            return eflags();
-        }
-        else if (name == "modules") {
-            return modulesString();
-        }
-        else if (name == "includes") {
-            return includes();
-        }
-        else if (name == "standard") {
-            return standard();
-        }
-        return {};
     }
 
     // Returns flag representation of both regular includes and system includes
     std::string includes() const {
+        if (isResolved()) {
+            return _resolved.includes.str();
+        }
+
         if (_parent) {
             auto parentIncludes = parent()->includes();
             auto includeStr = join(concatIncludes(), concatSysIncludes());
@@ -307,14 +443,14 @@ public:
     }
 
     std::string concatIncludes() const {
-        if (_includes.empty()) {
+        if (!_properties || _properties->includes.empty()) {
             return {};
         }
         std::ostringstream ss;
 
         auto includePrefix = ::includePrefix(flagStyle());
 
-        for (auto &i : _includes) {
+        for (auto &i : _properties->includes) {
             ss << includePrefix << i << " ";
         }
 
@@ -327,14 +463,14 @@ public:
     }
 
     std::string concatSysIncludes() const {
-        if (_sysIncludes.empty()) {
+        if (!_properties || _properties->sysIncludes.empty()) {
             return {};
         }
         std::ostringstream ss;
 
         auto includePrefix = ::sysIncludePrefix(flagStyle());
 
-        for (auto &i : _sysIncludes) {
+        for (auto &i : _properties->sysIncludes) {
             ss << includePrefix << i << " ";
         }
 
@@ -347,20 +483,20 @@ public:
     }
 
     void pushInclude(std::string includes) {
-        _includes.push_back(includes);
+        editProperties().includes.push_back(includes);
     }
 
     void pushSysInclude(std::string includes) {
-        _sysIncludes.push_back(includes);
+        editProperties().sysIncludes.push_back(includes);
     }
 
     void depfile(filesystem::path path) {
-        _depfile = path;
+        _depfile = path.string();
     }
 
     filesystem::path depfile() const {
         if (!_depfile.empty()) {
-            return dir() / _depfile;
+            return dir() / _depfile.str();
         }
         else {
             return {};
@@ -376,53 +512,107 @@ public:
     void command(std::string command) {
         shouldLinkFile(command != "[copy]");
         _command = command;
+        recordChange();
+        ++_generation;
     }
 
     std::string command() const {
+        if (isResolved() && _resolved.hasCommand) {
+            return _resolved.command.str();
+        }
+
         if (_command.empty()) {
             if (_parent) {
                 return _parent->command();
             }
         }
         else {
-            if (_command.front() == '[' && _command.back() == ']') {
-                return commandAt(_command.substr(1, _command.size() - 2));
+            auto &command = _command.str();
+            if (command.front() == '[' && command.back() == ']') {
+                return commandAt(command.substr(1, command.size() - 2));
             }
             else {
-                return _command;
+                return command;
             }
         }
         throw std::runtime_error{"no command specified for target " + name()};
     }
 
     void commands(std::map<std::string, std::string> commands) {
-        _commands = std::move(commands);
+        editProperties().commands = std::move(commands);
     }
 
     const std::map<std::string, std::string> &commands() const {
-        if (_commands.empty() && _parent) {
+        if ((!_properties || _properties->commands.empty()) && _parent) {
             return _parent->commands();
         }
-        return _commands;
+        return properties().commands;
     }
 
     // Get a single command from the commands-list
     std::string commandAt(std::string name) const {
-        if (name == "none") {
+        // The root only groups the targets
+        if (name == "none" || name == "root") {
             return "";
         }
         else if (name == "test") {
             return commandAt("exe");
         }
-        else if (auto f = _commands.find(name); f != _commands.end()) {
-            return f->second;
+        else if (_properties) {
+            if (auto f = _properties->commands.find(name);
+                f != _properties->commands.end()) {
+                return f->second;
+            }
         }
-        else if (_parent) {
+
+        if (_parent) {
             return _parent->commandAt(name);
         }
         return name;
     }
 
+    //! Name of the builtin command without brackets, eg "cxx" for "[cxx]"
+    //! Empty for custom commands
+    std::string commandName() const {
+        if (_command.empty()) {
+            if (_parent) {
+                return _parent->commandName();
+            }
+            return {};
+        }
+
+        auto &command = _command.str();
+        if (command.size() < 2 || command.front() != '[' ||
+            command.back() != ']') {
+            return {}; // Custom command
+        }
+
+        return command.substr(1, command.size() - 2);
+    }
+
+    //! Name of the pool that limits how many tasks of the same kind that can
+    //! run at the same time. The pool is named after the command, except for
+    //! linking commands that all share the pool "link"
+    std::string pool() const {
+        auto name = commandName();
+
+        if (name == "exe" || name == "so" || name == "static" ||
+            name == "test") {
+            return "link";
+        }
+
+        return name;
+    }
+
+    //! Pool sizes declared on this task
+    void pools(std::map<std::string, size_t> pools) {
+        editProperties().pools = std::move(pools);
+    }
+
+    const std::map<std::string, size_t> &pools() const {
+        return properties().pools;
+    }
+
     std::string extension() const {
         auto command = this->command();
         if (!command.empty()) {
@@ -432,12 +622,16 @@ public:
     }
 
     void cxx(filesystem::path cxx) {
-        _cxx = cxx;
+        editProperties().cxx = cxx.string();
     }
 
     filesystem::path cxx() const {
-        if (!_cxx.empty()) {
-            return _cxx;
+        if (isResolved()) {
+            return _resolved.cxx.str();
+        }
+
+        if (_properties && !_properties->cxx.empty()) {
+            return _properties->cxx.str();
         }
         else if (_parent) {
             return _parent->cxx();
@@ -448,12 +642,16 @@ public:
     }
 
     void cc(filesystem::path cc) {
-        _cc = cc;
+        editProperties().cc = cc.string();
     }
 
     filesystem::path cc() const {
-        if (!_cc.empty()) {
-            return _cc;
+        if (isResolved()) {
+            return _resolved.cc.str();
+        }
+
+        if (_properties && !_properties->cc.empty()) {
+            return _properties->cc.str();
         }
         else if (_parent) {
             return _parent->cc();
@@ -464,12 +662,16 @@ public:
     }
 
     void ar(filesystem::path ar) {
-        _ar = ar;
+        editProperties().ar = ar.string();
     }
 
     filesystem::path ar() const {
-        if (!_ar.empty()) {
-            return _ar;
+        if (isResolved()) {
+            return _resolved.ar.str();
+        }
+
+        if (_properties && !_properties->ar.empty()) {
+            return _properties->ar.str();
         }
         else if (_parent) {
             return _parent->ar();
@@ -487,10 +689,10 @@ public:
     }
 
     bool exists() {
-        return filesystem::exists(out());
+        return statCache().stat(out()).exists;
     }
 
-    TaskState state() {
+    TaskState state() const {
         return _state;
     }
 
@@ -532,7 +734,7 @@ public:
         return ss.str();
     }
 
-    std::vector<Task *> subscribers() {
+    const std::vector<Task *> &subscribers() const {
         return _subscribers;
     }
 
@@ -543,46 +745,53 @@ public:
     }
 
     void updateChangedTime() {
-        auto filename = out();
-        if (filesystem::exists(filename)) {
-            _changedTime = filesystem::last_write_time(filename);
-        }
-        else {
-            _changedTime = {};
-        }
+        // Time is zero for files that does not exist
+        _changedTime = statCache().stat(out()).mtime;
         _isChangedTimeCurrent = true;
     }
 
     std::string ldflags() const {
-        if (_ldflags.empty() && _parent) {
+        if (isResolved()) {
+            return _resolved.ldflags.str();
+        }
+
+        if ((!_properties || _properties->ldflags.empty()) && _parent) {
             return _parent->ldflags();
         }
 
-        return _ldflags;
+        return properties().ldflags.str();
     }
 
     void ldflags(std::string value) {
-        _ldflags = value;
+        editProperties().ldflags = value;
     }
 
     //! Flags used when preprocessing files
     std::string eflags() const {
-        if (_eflags.empty() && _parent) {
+        if (isResolved()) {
+            return _resolved.eflags.str();
+        }
+
+        if ((!_properties || _properties->eflags.empty()) && _parent) {
             return _parent->eflags();
         }
 
-        return _eflags;
+        return properties().eflags.str();
     }
 
     void eflags(std::string value) {
-        _eflags = value;
+        editProperties().eflags = value;
     }
 
     void config(std::vector<std::string> value) {
-        _config = value;
+        editProperties().config = std::move(value);
     }
 
     std::string config() const {
+        if (isResolved()) {
+            return _resolved.config.str();
+        }
+
         std::ostringstream ss;
         if (_parent) {
             auto parentConfig = _parent->config();
@@ -593,11 +802,11 @@ public:
 
         auto flagStyle = this->flagStyle();
 
-        for (auto &c : _config) {
+        for (auto &c : properties().config) {
             ss << translateConfig(c, flagStyle) << " ";
         }
 
-        auto extraConfig = commandSpecificConfig(_command, flagStyle);
+        auto extraConfig = commandSpecificConfig(_command.str(), flagStyle);
         if (!extraConfig.empty()) {
             ss << extraConfig << " ";
         }
@@ -610,6 +819,10 @@ public:
     }
 
     FlagStyle flagStyle() const {
+        if (isResolved()) {
+            return _resolved.flagStyle;
+        }
+
         if (_flagStyle == FlagStyle::Inherit && _parent) {
             return _parent->flagStyle();
         }
@@ -619,6 +832,8 @@ public:
 
     void flagStyle(FlagStyle value) {
         _flagStyle = value;
+        recordChange();
+        ++_generation;
     }
 
     void flagStyle(std::string value) {
@@ -628,17 +843,24 @@ public:
         else {
             _flagStyle = FlagStyle::Gcc;
         }
+        recordChange();
+        ++_generation;
     }
 
     //! In some cases you only need to know the c++-standard
     //! Notice the reverse order, because we want to catch the latest
     //! config that is specified
     std::string standard() const {
-        auto f = std::find_if(_config.rbegin(), _config.rend(), [](auto &x) {
+        if (isResolved()) {
+            return _resolved.standard.str();
+        }
+
+        auto &config = properties().config;
+        auto f = std::find_if(config.rbegin(), config.rend(), [](auto &x) {
             return x.rfind("c++") != std::string::npos;
         });
 
-        if (f != _config.rend()) {
+        if (f != config.rend()) {
             return translateConfig(*f, flagStyle());
         }
         else if (_parent) {
@@ -649,35 +871,56 @@ public:
     }
 
     std::string flags() const {
-        if (_flags.empty() && _parent) {
+        if (isResolved()) {
+            return _resolved.flags.str();
+        }
+
+        if ((!_properties || _properties->flags.empty()) && _parent) {
             return _parent->flags();
         }
 
-        return _flags;
+        return properties().flags.str();
     }
 
     void flags(std::string flags) {
-        _flags = flags;
+        editProperties().flags = flags;
     }
 
     std::string depprefix() const {
-        if (_depprefix.empty() && _parent) {
+        if (isResolved()) {
+            return _resolved.depprefix.str();
+        }
+
+        if ((!_properties || _properties->depprefix.empty()) && _parent) {
             return _parent->depprefix();
         }
 
-        return _depprefix;
+        return properties().depprefix.str();
     }
 
     void depprefix(std::string value) {
-        _depprefix = value;
+        editProperties().depprefix = value;
     }
 
     bool isRoot() {
-        return _command == "[root]";
+        return _command.str() == "[root]";
     }
 
     bool isTest() {
-        return _command == "[test]";
+        return _command.str() == "[test]";
+    }
+
+    //! Calculate the state again on the next call to updateState(), used when
+    //! the task list is kept in memory between builds
+    void resetState() {
+        _state = TaskState::NotCalculated;
+        _isChangedTimeCurrent = false;
+        _triggers.clear();
+        for (auto in : _in) {
+            if (in->shouldLinkFile()) {
+                _triggers.push_back(in);
+            }
+        }
     }
 
     //! Remove triggers that is raw or fresh
@@ -717,6 +960,10 @@ public:
             return;
         }
 
+        // Tasks without output, eg the root, has no time to compare with and
+        // is only dirty when something they depend on is dirty
+        bool hasOut = !_out.empty();
+
         for (auto &in : _in) {
             if (this == in) {
                 throw std::runtime_error{name() +
@@ -725,7 +972,7 @@ public:
 
             in->updateState();
             if (in->state() == TaskState::Raw) {
-                if (in->changedTime() > changedTime()) {
+                if (hasOut && in->changedTime() > changedTime()) {
                     _state = TaskState::DirtyReady;
                 }
             }
@@ -733,19 +980,25 @@ public:
                 _state = TaskState::DirtyWaiting;
                 return; // No need to check more if other task is blocking
             }
-            else if (in->changedTime() >= changedTime()) {
+            else if (hasOut && in->changedTime() >= changedTime()) {
                 _state = TaskState::DirtyReady;
                 return;
             }
         }
 
-        if (!_out.empty() && !exists()) {
+        if (hasOut && !exists()) {
+            _state = TaskState::DirtyReady;
+            return;
+        }
+
+        if (_isCommandChanged) {
             _state = TaskState::DirtyReady;
             return;
         }
 
         for (auto &trigger : _triggers) {
-            if (trigger->isDirty() || trigger->changedTime() >= changedTime()) {
+            if (trigger->isDirty() ||
+                (hasOut && trigger->changedTime() >= changedTime())) {
                 _state = TaskState::DirtyReady;
                 return;
             }
@@ -782,6 +1035,15 @@ public:
         return removed;
     }
 
+    //! If the command has changed since the last time the task was built
+    void isCommandChanged(bool value) {
+        _isCommandChanged = value;
+    }
+
+    bool isCommandChanged() const {
+        return _isCommandChanged;
+    }
+
     //! IF the file should be used in its parent task at input
     void shouldLinkFile(bool value) {
         _shouldLinkFile = value;
@@ -791,30 +1053,130 @@ public:
         return _shouldLinkFile;
     }
 
+    //! Calculate the properties that is inherited from the parents once,
+    //! instead of walking up the tree and building strings on every call
+    //! Changing the task or any of its parents makes the getters calculate
+    //! the values again until this is called again. Not thread safe
+    void resolveProperties() {
+        if (isResolved()) {
+            return;
+        }
+
+        if (_parent) {
+            _parent->resolveProperties();
+        }
+
+        // The getters calculates the values since this task is not resolved,
+        // and uses the resolved values of the parent
+        auto resolved = ResolvedTaskProperties{};
+        resolved.out = out();
+        resolved.dir = dir().string();
+        resolved.hasCommand =
+            !_command.empty() || (_parent && _parent->_resolved.hasCommand);
+        if (resolved.hasCommand) {
+            resolved.command = command();
+        }
+        resolved.cxx = cxx().string();
+        resolved.cc = cc().string();
+        resolved.ar = ar().string();
+        resolved.flags = flags();
+        resolved.ldflags = ldflags();
+        resolved.eflags = eflags();
+        resolved.depprefix = depprefix();
+        resolved.includes = includes();
+        resolved.config = config();
+        resolved.standard = standard();
+        resolved.flagStyle = flagStyle();
+
+        resolved.parent = _parent;
+        resolved.generation = _generation;
+        resolved.stamp = ++_resolveStamp;
+        resolved.parentStamp = _parent ? _parent->_resolved.stamp : 0;
+
+        _resolved = std::move(resolved);
+    }
+
+    //! Use the same properties as another task if they are equal, to save
+    //! memory when many tasks has the same settings
+    void shareProperties(const Task &other) {
+        if (_properties && other._properties &&
+            _properties != other._properties &&
+            *_properties == *other._properties) {
+            _properties = other._properties;
+        }
+    }
+
     Json dump();
 
+    //! Save the settings of the task itself, not the properties, edges or
+    //! anything that is inherited or calculated. See graphcache.h
+    void writeBinary(class BinaryWriter &writer) const;
+    void readBinary(class BinaryReader &reader);
+
+    //! The properties block that can be shared with other tasks, nullptr if
+    //! no properties is set. Used to save each block once
+    const std::shared_ptr<TaskProperties> &sharedProperties() const {
+        return _properties;
+    }
+
+    void sharedProperties(std::shared_ptr<TaskProperties> properties) {
+        _properties = std::move(properties);
+        ++_generation;
+    }
+
     //! Print tree view from node
     void print(bool verbose = false, size_t indentation = 0);
 
 private:
+    void recordChange() {
+        if (_changeLog && !_isChangeRecorded) {
+            _isChangeRecorded = true;
+            _changeLog->push_back(this);
+        }
+    }
+
+    //! The resolved values can be used if nothing has changed on the task or
+    //! on the parents since they was resolved
+    bool isResolved() const {
+        if (_resolved.generation != _generation || _resolved.parent != _parent) {
+            return false;
+        }
+        return !_parent || (_parent->isResolved() &&
+                            _parent->_resolved.stamp == _resolved.parentStamp);
+    }
+
+    //! Properties of this task, or empty properties if none is set
+    const TaskProperties &properties() const {
+        static const auto empty = TaskProperties{};
+        return _properties ? *_properties : empty;
+    }
+
+    //! Shared properties is copied before they are changed
+    TaskProperties &editProperties() {
+        ++_generation;
+        if (!_properties) {
+            _properties = std::make_shared<TaskProperties>();
+        }
+        else if (_properties.use_count() > 1) {
+            _properties = std::make_shared<TaskProperties>(*_properties);
+        }
+        return *_properties;
+    }
+
+    inline static size_t _resolveStamp = 0;
+
     Task *_parent = nullptr;
+    uint32_t _index = 0; // Set by TaskList
+    std::vector<Task *> *_changeLog = nullptr; // Set by TaskList
+    bool _isChangeRecorded = false;
     filesystem::path _out;
-    std::array<filesystem::path, static_cast<size_t>(BuildLocation::Count)>
-        _dir;
-    filesystem::path _depfile;
-    filesystem::path _cxx;
-    filesystem::path _cc;
-    filesystem::path _ar;
-    std::string _name;                            // If empty-same as out
-    std::string _command;                         // If empty use parents
-    std::map<std::string, std::string> _commands; // Parents build command
-    std::string _flags;
-    std::string _ldflags;
-    std::string _eflags;
-    std::string _depprefix;
-    std::vector<std::string> _includes;
-    std::vector<std::string> _sysIncludes;
-    std::vector<std::string> _config;
+    std::array<InternedString, static_cast<size_t>(BuildLocation::Count)> _dir;
+    InternedString _depfile;
+    std::string _name;       // If empty-same as out
+    InternedString _command; // If empty use parents
+    std::shared_ptr<TaskProperties> _properties;
+    size_t _generation = 1; // Increased when something is changed
+    ResolvedTaskProperties _resolved;
     FlagStyle _flagStyle = FlagStyle::Inherit;
     BuildLocation _buildLocation = BuildLocation::Real;
 
@@ -827,5 +1189,6 @@ private:
     TimePoint _changedTime;
     bool _isChangedTimeCurrent = false;
     bool _shouldLinkFile = true;
+    bool _isCommandChanged = false;
     TaskState _state = TaskState::NotCalculated;
 };
@@ -1,7 +1,20 @@
 #include "tasklist.h"
+#include "buildlog.h"
+#include "depslog.h"
+#include "hash.h"
+#include "nativecommands.h"
 #include "parsedepfile.h"
+#include "processedcommand.h"
+#include "statcache.h"
+#include "trace.h"
 #include "json/json.h"
+#include <atomic>
+#include <exception>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace {
 
@@ -49,28 +62,355 @@ void connectTasks(TaskList &list, const Json &json) {
     }
 }
 
+//! Resolve the inherited properties before they are used by many tasks
+//! Parents is resolved before their children so this is not done in parallel
+void resolveTaskProperties(TaskList &list) {
+    for (auto &task : list) {
+        task->resolveProperties();
+    }
+}
+
+//! Mark tasks whose command is not the same as the last time they was built
+//! by the native backend, eg when flags has changed
+void checkCommands(TaskList &list, const BuildLog &log) {
+    for (auto &task : list) {
+        auto out = task->out();
+        if (out.empty()) {
+            continue;
+        }
+
+        auto record = log.latest(out.string());
+        if (!record) {
+            continue;
+        }
+
+        auto command = task->command();
+        if (native::findCommand(command)) {
+            continue;
+        }
+
+        auto hash = fnv1a(ProcessedCommand::cached(command).expand(*task));
+        task->isCommandChanged(hash != record->commandHash);
+    }
+}
+
+//! Find a loop among tasks that could not be sorted, each of them has at
+//! least one input that is also left
+std::string describeCycle(const TaskList &list,
+                          const std::vector<Task *> &left,
+                          const std::vector<uint32_t> &numIn) {
+    auto isLeft = [&](Task *task) {
+        return list.contains(task) && numIn.at(task->index()) > 0;
+    };
+
+    auto path = std::vector<Task *>{};
+    auto visited = std::unordered_map<Task *, size_t>{}; // Position in path
+
+    auto task = left.front();
+    while (!visited.count(task)) {
+        visited[task] = path.size();
+        path.push_back(task);
+        for (auto in : task->in()) {
+            if (isLeft(in)) {
+                task = in;
+                break;
+            }
+        }
+    }
+
+    auto loop = std::vector<Task *>(path.begin() + visited.at(task), path.end());
+
+    if (loop.size() == 1) {
+        return loop.front()->name() + " is trying to import itself";
+    }
+
+    auto description = std::string{"dependency cycle (task -> input): "};
+    for (auto t : loop) {
+        description += t->name() + " -> ";
+    }
+    description += loop.front()->name();
+
+    return description;
+}
+
+//! Run a function for each task, split on threads if there is many tasks
+template <typename F>
+void forEachTask(const std::vector<Task *> &tasks, F f) {
+    constexpr size_t minTasksPerThread = 2048;
+
+    auto numThreads = std::min<size_t>(
+        tasks.size() / minTasksPerThread,
+        std::max<size_t>(std::thread::hardware_concurrency(), 1));
+
+    if (numThreads < 2) {
+        for (auto task : tasks) {
+            f(task);
+        }
+        return;
+    }
+
+    auto next = std::atomic_size_t{0};
+    auto error = std::exception_ptr{};
+    auto errorMutex = std::mutex{};
+
+    auto work = [&] {
+        try {
+            for (size_t i; (i = next++) < tasks.size();) {
+                f(tasks[i]);
+            }
+        }
+        catch (...) {
+            auto lock = std::scoped_lock{errorMutex};
+            error = std::current_exception();
+            next = tasks.size();
+        }
+    };
+
+    auto threads = std::vector<std::thread>{};
+    for (size_t i = 1; i < numThreads; ++i) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
 } // namespace
 
+TaskGraph createTaskGraph(const TaskList &list) {
+    auto graph = TaskGraph{};
+    graph.offsets.reserve(list.size() + 1);
+
+    for (auto task : list) {
+        graph.offsets.push_back(static_cast<uint32_t>(graph.edges.size()));
+        for (auto subscriber : task->subscribers()) {
+            if (list.contains(subscriber)) {
+                graph.edges.push_back(subscriber->index());
+            }
+        }
+    }
+    graph.offsets.push_back(static_cast<uint32_t>(graph.edges.size()));
+
+    return graph;
+}
+
+void TaskGraph::loadState(const TaskList &list) {
+    states.clear();
+    states.reserve(list.size());
+    for (auto task : list) {
+        states.push_back(task->state());
+    }
+
+    numPending.assign(list.size(), 0);
+    for (uint32_t i = 0; i < states.size(); ++i) {
+        if (isDirty(states[i])) {
+            for (auto subscriber : subscribers(i)) {
+                ++numPending[subscriber];
+            }
+        }
+    }
+
+    for (size_t i = 0; i < states.size(); ++i) {
+        // Waiting for something that is not built in this list
+        if (states[i] == TaskState::DirtyWaiting && !numPending[i]) {
+            states[i] = TaskState::DirtyReady;
+        }
+    }
+
+    priorities.assign(list.size(), 0);
+}
+
+std::vector<std::vector<Task *>> sortTasks(const TaskList &list) {
+    auto graph = createTaskGraph(list);
+
+    // Inputs outside of the list does not need to be waited for
+    auto numIn = std::vector<uint32_t>(list.size(), 0);
+    for (auto edge : graph.edges) {
+        ++numIn[edge];
+    }
+
+    auto levels = std::vector<std::vector<Task *>>{};
+    auto level = std::vector<Task *>{};
+
+    for (auto task : list) {
+        if (!numIn[task->index()]) {
+            level.push_back(task);
+        }
+    }
+
+    size_t numSorted = 0;
+
+    while (!level.empty()) {
+        auto next = std::vector<Task *>{};
+        for (auto task : level) {
+            for (auto subscriber : graph.subscribers(task->index())) {
+                if (--numIn[subscriber] == 0) {
+                    next.push_back(list._tasks[subscriber]);
+                }
+            }
+        }
+        numSorted += level.size();
+        levels.push_back(std::move(level));
+        level = std::move(next);
+    }
+
+    if (numSorted < list.size()) {
+        auto left = std::vector<Task *>{};
+        for (auto task : list) {
+            if (numIn[task->index()]) {
+                left.push_back(task);
+            }
+        }
+        throw std::runtime_error{describeCycle(list, left, numIn)};
+    }
+
+    return levels;
+}
+
 void calculateState(TaskList &list) {
+    resolveTaskProperties(list);
+
+    {
+        auto paths = std::vector<filesystem::path>{};
+        paths.reserve(list.size());
+        for (auto &task : list) {
+            paths.push_back(task->out());
+        }
+        statCache().prefetch(paths);
+    }
+
+    list._depsLog = std::make_unique<DepsLog>();
+    if (auto root = list.findRoot()) {
+        list._depsLog = std::make_unique<DepsLog>(depsLogPath(*root));
+        checkCommands(list, BuildLog{buildLogPath(*root)});
+    }
+
+    auto &depsLog = *list._depsLog;
+    auto depfileContent = DepFileContent{};
+
     for (auto &task : list) {
         auto depfile = task->depfile();
         if (depfile.empty()) {
             continue;
         }
-        for (auto &f : parseDepFile(depfile).deps) {
-            task->pushIn(list.find(f.string()));
+
+        auto out = task->out().string();
+        auto mtime = DepsLog::toMtime(task->changedTime());
+
+        if (auto record = depsLog.find(out);
+            record && record->mtime == mtime) {
+            for (auto dep : record->deps) {
+                task->pushIn(list.find(*dep));
+            }
+            continue;
+        }
+
+        // The file was built by another backend or by an older version
+        if (!parseDepFile(depfile, depfileContent)) {
+            continue;
+        }
+
+        for (auto dep : depfileContent.deps) {
+            task->pushIn(list.find(dep));
+        }
+
+        if (!depfileContent.deps.empty() && task->exists()) {
+            depsLog.record(out, mtime, depfileContent.deps);
         }
     }
 
+    // Headers from depfiles has got new parents
+    resolveTaskProperties(list);
+
+    // Every input is calculated before the tasks that uses it, so
+    // updateState() never has to recurse, and tasks on the same level can be
+    // calculated in parallel
+    for (auto &level : sortTasks(list)) {
+        forEachTask(level, [](Task *task) { task->updateState(); });
+    }
+
     for (auto &task : list) {
-        task->updateState();
+        task->pruneTriggers();
     }
+}
+
+void markDirty(TaskList &list, const std::vector<Task *> &changed) {
+    auto affected = std::vector<Task *>{};
+    auto isAffected = std::unordered_set<Task *>{};
+    auto add = [&](Task *task) {
+        if (isAffected.insert(task).second) {
+            affected.push_back(task);
+        }
+    };
+
+    auto depfileContent = DepFileContent{};
 
     for (auto &task : list) {
+        switch (task->state()) {
+        case TaskState::Raw:
+        case TaskState::Fresh:
+            break;
+        case TaskState::Done:
+            // New headers can have been included since the last build
+            if (auto depfile = task->depfile();
+                !depfile.empty() && parseDepFile(depfile, depfileContent)) {
+                for (auto dep : depfileContent.deps) {
+                    task->pushIn(list.find(dep));
+                }
+            }
+            task->updateChangedTime();
+            task->isCommandChanged(false);
+            task->setState(TaskState::Fresh);
+            break;
+        default:
+            add(task); // Failed or interrupted
+            break;
+        }
+    }
+
+    for (auto task : changed) {
+        statCache().invalidate(task->out());
+        add(task);
+    }
+
+    for (size_t i = 0; i < affected.size(); ++i) {
+        for (auto subscriber : affected.at(i)->subscribers()) {
+            add(subscriber);
+        }
+    }
+
+    for (auto task : affected) {
+        task->resetState();
+    }
+
+    resolveTaskProperties(list);
+
+    for (auto &level : sortTasks(list)) {
+        forEachTask(level, [](Task *task) { task->updateState(); });
+    }
+
+    for (auto task : affected) {
         task->pruneTriggers();
     }
 }
 
+filesystem::path depsLogPath(const Task &root) {
+    return root.dir(BuildLocation::Intermediate) / ".matmake_deps";
+}
+
+filesystem::path buildLogPath(const Task &root) {
+    return root.dir(BuildLocation::Intermediate) / ".matmake_log";
+}
+
+filesystem::path projectStateDir() {
+    return filesystem::path{"build"} / ".matmake";
+}
+
 std::unique_ptr<TaskList> parseTasks(filesystem::path path) {
     auto list = std::make_unique<TaskList>();
     auto json = Json{};
@@ -88,7 +428,13 @@ std::unique_ptr<TaskList> parseTasks(filesystem::path path) {
     list->reserve(json.size());
 
     for (const auto &jtask : json) {
-        list->emplace().parse(jtask);
+        auto &task = list->emplace();
+        task.parse(jtask);
+
+        // Task files often repeats the same settings for many tasks in a row
+        if (list->_tasks.size() > 1) {
+            task.shareProperties(**(list->_tasks.end() - 2));
+        }
     }
 
     connectTasks(*list, json);
@@ -116,6 +462,7 @@ void printFlat(const TaskList &list) {
 }
 
 void createDirectories(const TaskList &tasks) {
+    auto span = TraceScope{"createDirectories"};
 
     auto directories = std::map<filesystem::path, int>{};
 
@@ -127,10 +474,13 @@ void createDirectories(const TaskList &tasks) {
         if (it.first.empty()) {
             continue;
         }
-        else if (!filesystem::exists(it.first)) {
+
+        auto stat = statCache().stat(it.first);
+        if (!stat.exists) {
             filesystem::create_directories(it.first);
+            statCache().invalidate(it.first);
         }
-        else if (!filesystem::is_directory(it.first)) {
+        else if (!stat.isDirectory) {
             throw std::runtime_error{"expected " + it.first.string() +
                                      " to be a directory "
                                      "but it is a file"};
@@ -1,9 +1,53 @@
 #pragma once
+#include "depslog.h"
 #include "filesystem.h"
 #include "task.h"
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+//! Storage for a fixed number of tasks that is never moved or reallocated
+class TaskBlock {
+public:
+    static constexpr size_t capacity = 256;
+
+    TaskBlock()
+        : _slots{new Slot[capacity]} {}
+
+    TaskBlock(const TaskBlock &) = delete;
+    TaskBlock &operator=(const TaskBlock &) = delete;
+
+    ~TaskBlock() {
+        for (size_t i = 0; i < _size; ++i) {
+            reinterpret_cast<Task *>(&_slots[i])->~Task();
+        }
+    }
+
+    bool isFull() const {
+        return _size == capacity;
+    }
+
+    Task &emplace() {
+        auto task = new (&_slots[_size]) Task{};
+        ++_size;
+        return *task;
+    }
+
+private:
+    // Uninitialized memory so that unused slots is not constructed
+    struct alignas(Task) Slot {
+        std::byte data[sizeof(Task)];
+    };
+
+    std::unique_ptr<Slot[]> _slots;
+    size_t _size = 0;
+};
+
 struct TaskList {
     TaskList() = default;
     TaskList(const TaskList &) = delete;
@@ -11,59 +55,106 @@ struct TaskList {
     TaskList(TaskList &&) = default;
     TaskList &operator=(TaskList &&) = default;
 
-    std::vector<std::unique_ptr<Task>> _tasks;
+    // Tasks is allocated in fixed size blocks that is owned by the list and
+    // never moved, so pointers to tasks stays valid when the list is moved
+    std::vector<std::unique_ptr<TaskBlock>> _blocks;
+    std::vector<Task *> _tasks;
+
+    // The deps log read by calculateState(), kept so that the build can
+    // append to it without reading the file again
+    std::unique_ptr<DepsLog> _depsLog;
 
     void reserve(size_t size) {
         _tasks.reserve(size);
     }
 
     Task &emplace() {
-        _tasks.emplace_back(std::make_unique<Task>());
-        return *_tasks.back();
+        if (_blocks.empty() || _blocks.back()->isFull()) {
+            _blocks.push_back(std::make_unique<TaskBlock>());
+        }
+        auto &task = _blocks.back()->emplace();
+        task.index(static_cast<uint32_t>(_tasks.size()));
+        task.changeLog(&changeLog());
+        _tasks.push_back(&task);
+        return task;
     }
 
+    //! Take over the tasks of another list without moving them in memory
+    //! The blocks of the other list is kept as they are, so prefer to create
+    //! tasks directly in the final list
     void insert(TaskList tasks) {
         _tasks.reserve(_tasks.size() + tasks._tasks.size());
 
-        for (auto &task : tasks._tasks) {
-            _tasks.push_back(std::move(task));
+        auto &log = changeLog();
+        for (auto task : tasks._tasks) {
+            task->index(static_cast<uint32_t>(_tasks.size()));
+            task->changeLog(&log);
+            _tasks.push_back(task);
         }
 
+        for (auto &block : tasks._blocks) {
+            _blocks.push_back(std::move(block));
+        }
         tasks.clear();
     }
 
-    Task *find(std::string name) const {
+    //! Check that a task, eg found through its inputs, belongs to this list
+    bool contains(const Task *task) const {
+        return task && task->index() < _tasks.size() &&
+               _tasks[task->index()] == task;
+    }
+
+    //! Find a task by "@name", by "./raw/out" or by the full output path
+    //! New tasks is added to the lookup tables and changed tasks is moved in
+    //! them on the next call. Not thread safe
+    Task *find(std::string_view name) const {
         if (name.empty()) {
             return nullptr;
         }
-        if (name.front() == '@') {
-            name = name.substr(1);
-            for (auto &t : _tasks) {
-                if (t->name() == name) {
-                    return t.get();
+
+        updateIndex();
+
+        // The first task wins if there is duplicates
+        auto lookup = [](auto &map, std::string_view key) -> Task * {
+            auto range = map.equal_range(std::string{key});
+            auto found = static_cast<Task *>(nullptr);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (!found || it->second->index() < found->index()) {
+                    found = it->second;
                 }
             }
+            return found;
+        };
+
+        if (name.front() == '@') {
+            return lookup(_names, name.substr(1));
         }
-        else if (name.rfind("./") == 0) {
-            for (auto &t : _tasks) {
-                if (t->rawOut() == name) {
-                    return t.get();
-                }
-            }
+        else if (name.rfind("./", 0) == 0) {
+            return lookup(_rawOuts, name);
         }
         else {
-            for (auto &t : _tasks) {
-                if (t->out() == name) {
-                    return t.get();
-                }
-            }
+            return lookup(_outs, name);
         }
+    }
 
+    //! The task created from the [root] node, nullptr if there is none
+    Task *findRoot() const {
+        for (auto task : _tasks) {
+            if (task->isRoot()) {
+                return task;
+            }
+        }
         return nullptr;
     }
 
     void clear() {
         _tasks.clear();
+        _blocks.clear();
+        _names.clear();
+        _rawOuts.clear();
+        _outs.clear();
+        _keys.clear();
+        _changeLog.reset();
     }
 
     Task &at(size_t i) {
@@ -97,12 +188,176 @@ struct TaskList {
     bool empty() const {
         return _tasks.empty();
     }
+
+    size_t size() const {
+        return _tasks.size();
+    }
+
+private:
+    using Index = std::unordered_multimap<std::string, Task *>;
+
+    //! The keys that a task has in the lookup tables
+    struct Keys {
+        std::string name;
+        std::string rawOut;
+        std::string out;
+    };
+
+    std::vector<Task *> &changeLog() {
+        if (!_changeLog) {
+            // On the heap so that the tasks can point to it when the list is
+            // moved
+            _changeLog = std::make_unique<std::vector<Task *>>();
+        }
+        return *_changeLog;
+    }
+
+    static void replaceKey(Index &index,
+                           std::string &key,
+                           std::string newKey,
+                           Task *task) {
+        if (key == newKey) {
+            return;
+        }
+        auto range = index.equal_range(key);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == task) {
+                index.erase(it);
+                break;
+            }
+        }
+        key = std::move(newKey);
+        index.emplace(key, task);
+    }
+
+    void updateIndex() const {
+        if (_changeLog && !_changeLog->empty()) {
+            // The full output path depends on the parents, so the tasks below
+            // a changed task is checked too. They are found through the
+            // inputs that has the task as parent
+            auto stack = std::move(*_changeLog);
+            _changeLog->clear();
+            auto visited = std::unordered_set<Task *>{};
+
+            while (!stack.empty()) {
+                auto task = stack.back();
+                stack.pop_back();
+                if (!visited.insert(task).second) {
+                    continue;
+                }
+                task->clearChange();
+
+                if (contains(task) && task->index() < _keys.size()) {
+                    auto &keys = _keys[task->index()];
+                    replaceKey(_names, keys.name, task->name(), task);
+                    replaceKey(
+                        _rawOuts, keys.rawOut, task->rawOut().string(), task);
+                    replaceKey(_outs, keys.out, task->out().string(), task);
+                }
+
+                for (auto list : {&task->in(), &task->triggers()}) {
+                    for (auto child : *list) {
+                        if (child->parent() == task) {
+                            stack.push_back(child);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Tasks that is added since the last call
+        _keys.reserve(_tasks.size());
+        for (auto i = _keys.size(); i < _tasks.size(); ++i) {
+            auto task = _tasks[i];
+            auto &keys = _keys.emplace_back(Keys{
+                task->name(), task->rawOut().string(), task->out().string()});
+            _names.emplace(keys.name, task);
+            _rawOuts.emplace(keys.rawOut, task);
+            _outs.emplace(keys.out, task);
+        }
+    }
+
+    mutable Index _names;
+    mutable Index _rawOuts;
+    mutable Index _outs;
+    mutable std::vector<Keys> _keys; // By task index
+    std::unique_ptr<std::vector<Task *>> _changeLog;
+};
+
+//! The subscribers of every task in a list stored in two flat arrays, where
+//! tasks are referred to by their index. Subscribers outside of the list is
+//! left out
+//! The scheduling state of a build is kept in arrays next to the edges
+//! instead of in the tasks
+struct TaskGraph {
+    struct Edges {
+        const uint32_t *first = nullptr;
+        const uint32_t *last = nullptr;
+
+        const uint32_t *begin() const {
+            return first;
+        }
+
+        const uint32_t *end() const {
+            return last;
+        }
+
+        size_t size() const {
+            return static_cast<size_t>(last - first);
+        }
+    };
+
+    std::vector<uint32_t> offsets; // Where the edges of each task starts
+    std::vector<uint32_t> edges;
+
+    // Set by loadState(), indexed like the tasks
+    std::vector<TaskState> states;
+    std::vector<uint32_t> numPending; // Dirty inputs that is not finished
+    std::vector<double> priorities;
+
+    Edges subscribers(uint32_t index) const {
+        return {edges.data() + offsets.at(index),
+                edges.data() + offsets.at(index + 1)};
+    }
+
+    //! Copy the calculated state of the tasks and count the dirty inputs of
+    //! each task, before the tasks is scheduled
+    void loadState(const TaskList &list);
 };
 
+inline bool isDirty(TaskState state) {
+    return state == TaskState::DirtyReady || state == TaskState::DirtyWaiting;
+}
+
+TaskGraph createTaskGraph(const TaskList &list);
+
 void createDirectories(const TaskList &tasks);
 
 std::unique_ptr<TaskList> parseTasks(filesystem::path path);
 
+//! Dependencies from depfiles is read from the deps log in the intermediate
+//! directory of the root, depfiles is only parsed when the log is out of date
+//! Tasks whose command has changed since the last build is dirty
 void calculateState(TaskList &list);
 
+//! Calculate the state again after a build for a task list that is kept in
+//! memory. Only the changed tasks, the tasks that depends on them and tasks
+//! that was not built successfully is calculated again
+void markDirty(TaskList &list, const std::vector<Task *> &changed);
+
+//! Sort tasks in levels where every task comes after the levels of all its
+//! inputs. Tasks on the same level does not depend on each other
+//! Throws with the full loop if there is a dependency cycle
+std::vector<std::vector<Task *>> sortTasks(const TaskList &list);
+
+//! Path to the deps log of a build
+filesystem::path depsLogPath(const Task &root);
+
+//! Path to the build log of a build
+filesystem::path buildLogPath(const Task &root);
+
+//! Directory for files that is needed before the Matmakefile is parsed, when
+//! the directories of the target is not known yet
+filesystem::path projectStateDir();
+
 void printFlat(const TaskList &list);
@@ -0,0 +1,133 @@
+#include "trace.h"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+std::unique_ptr<Trace> currentTrace;
+
+void writeJsonString(std::ostream &stream, const std::string &str) {
+    stream << '"';
+    for (auto c : str) {
+        switch (c) {
+        case '"':
+            stream << "\\\"";
+            break;
+        case '\\':
+            stream << "\\\\";
+            break;
+        case '\n':
+            stream << "\\n";
+            break;
+        case '\t':
+            stream << "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                // Json does not allow control characters in strings
+                constexpr auto hex = std::string_view{"0123456789abcdef"};
+                stream << "\\u00" << hex[(c >> 4) & 0xf] << hex[c & 0xf];
+            }
+            else {
+                stream << c;
+            }
+        }
+    }
+    stream << '"';
+}
+
+} // namespace
+
+Trace::Trace()
+    : _start(std::chrono::steady_clock::now()) {}
+
+int64_t Trace::now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - _start)
+        .count();
+}
+
+void Trace::add(Span span) {
+    auto lock = std::scoped_lock{_mutex};
+    _spans.push_back(std::move(span));
+}
+
+void Trace::save(filesystem::path path) const {
+    auto file = std::ofstream{path};
+
+    if (!file.is_open()) {
+        throw std::runtime_error{"could not write trace to " + path.string()};
+    }
+
+    auto lock = std::scoped_lock{_mutex};
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    size_t numThreads = 0;
+    for (auto &span : _spans) {
+        numThreads = std::max(numThreads, span.thread + 1);
+    }
+
+    // Name the tracks
+    for (size_t i = 0; i < numThreads; ++i) {
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+             << i << ",\"args\":{\"name\":";
+        writeJsonString(file,
+                        i ? ("worker " + std::to_string(i - 1)) : "main");
+        file << "}},\n";
+    }
+
+    for (size_t i = 0; i < _spans.size(); ++i) {
+        auto &span = _spans.at(i);
+        file << "{\"name\":";
+        writeJsonString(file, span.name);
+        file << ",\"cat\":";
+        writeJsonString(file, span.category);
+        file << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread
+             << ",\"ts\":" << span.start << ",\"dur\":" << span.duration;
+        if (!span.out.empty()) {
+            file << ",\"args\":{\"out\":";
+            writeJsonString(file, span.out);
+            file << "}";
+        }
+        file << ((i + 1 < _spans.size()) ? "},\n" : "}\n");
+    }
+
+    file << "]}\n";
+}
+
+std::vector<Trace::Span> Trace::spans() const {
+    auto lock = std::scoped_lock{_mutex};
+    return _spans;
+}
+
+void startTrace() {
+    currentTrace = std::make_unique<Trace>();
+}
+
+Trace *trace() {
+    return currentTrace.get();
+}
+
+TraceScope::TraceScope(std::string name,
+                       std::string category,
+                       size_t thread,
+                       std::string out) {
+    if (auto t = trace()) {
+        _span.name = std::move(name);
+        _span.category = std::move(category);
+        _span.thread = thread;
+        _span.out = std::move(out);
+        _span.start = t->now();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (auto t = trace()) {
+        _span.duration = t->now() - _span.start;
+        t->add(std::move(_span));
+    }
+}
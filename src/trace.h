@@ -0,0 +1,62 @@
+#pragma once
+
+#include "filesystem.h"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//! Records spans of time that can be saved as a Chrome trace event file, to
+//! be viewed in chrome://tracing or https://ui.perfetto.dev
+class Trace {
+public:
+    struct Span {
+        std::string name;
+        std::string category;
+        std::string out;
+        size_t thread = 0; // 0 is the main thread
+        int64_t start = 0; // In microseconds since the trace was started
+        int64_t duration = 0;
+    };
+
+    Trace();
+
+    //! Time in microseconds since the trace was started
+    int64_t now() const;
+
+    //! Thread safe
+    void add(Span span);
+
+    void save(filesystem::path path) const;
+
+    //! Copy of the spans recorded so far
+    //! Thread safe
+    std::vector<Span> spans() const;
+
+private:
+    std::chrono::steady_clock::time_point _start;
+    mutable std::mutex _mutex;
+    std::vector<Span> _spans;
+};
+
+//! Start recording a trace for the rest of the program
+void startTrace();
+
+//! The trace for this run, or nullptr if tracing is not enabled
+Trace *trace();
+
+//! Records a span from construction to destruction if tracing is enabled
+class TraceScope {
+public:
+    TraceScope(std::string name,
+               std::string category = "phase",
+               size_t thread = 0,
+               std::string out = {});
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+    ~TraceScope();
+
+private:
+    Trace::Span _span;
+};
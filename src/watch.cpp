@@ -0,0 +1,516 @@
+#include "watch.h"
+#include "coordinator.h"
+#include "jobserver.h"
+#include "os.h"
+#include "prescan.h"
+#include "statcache.h"
+#include <array>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+#ifndef MATMAKE_USING_WINDOWS
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifndef MATMAKE_USING_WINDOWS
+
+constexpr uint32_t watchEventMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+
+// Editors and version control often writes many files at once, wait this long
+// for more changes before building
+constexpr int watchSettleTimeMs = 50;
+
+const auto watchedMatmakeFiles =
+    std::array<filesystem::path, 2>{"Matmakefile", "matmake.json"};
+
+// A client that does not send its request in this time is disconnected, so
+// that it can not block the watch process
+constexpr auto watchRequestTimeout = timeval{1, 0};
+
+constexpr auto watchStatusPrefix = std::string_view{"status "};
+constexpr auto watchRefusedResponse = std::string_view{"refused\n"};
+
+//! Inotify watches for the input files of a task list, the headers found when
+//! prescanning or in depfiles and the Matmakefile
+//! Directories is watched instead of files since many editors replaces the
+//! file when it is saved
+class FileWatcher {
+public:
+    FileWatcher()
+        : _fd{inotify_init1(IN_NONBLOCK | IN_CLOEXEC)} {
+        if (_fd < 0) {
+            throw std::runtime_error{"could not start watching files"};
+        }
+    }
+
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    ~FileWatcher() {
+        close(_fd);
+    }
+
+    int fd() const {
+        return _fd;
+    }
+
+    //! Watch the files of the tasks, called again after each build to find
+    //! new headers. Directories that is already watched is kept
+    void watch(const TaskList &tasks) {
+        _files.clear();
+
+        for (auto &task : tasks) {
+            if (task->state() == TaskState::Raw) {
+                add(task->out(), task);
+            }
+            else if (getType(task->out()) ==
+                     SourceType::ExpandedModuleSource) {
+                // The expanded file needs to be created again when a header
+                // is changed
+                for (auto &include : includes(*task)) {
+                    add(include, task);
+                }
+            }
+
+            // Headers from depfiles that is not tasks themselves, those is
+            // only known from the deps log
+            if (!task->depfile().empty() && tasks._depsLog) {
+                if (auto record = tasks._depsLog->find(task->out().string())) {
+                    for (auto dep : record->deps) {
+                        if (!tasks.find(*dep)) {
+                            add(*dep, task);
+                        }
+                    }
+                }
+            }
+        }
+
+        for (auto &file : watchedMatmakeFiles) {
+            add(file, nullptr);
+        }
+    }
+
+    //! Forget everything about the old tasks when the task list is recreated
+    void clear() {
+        _files.clear();
+        _includes.clear();
+    }
+
+    //! Read all events that is available without blocking. The changed files
+    //! is removed from the stat cache
+    //! @param changed tasks that depends on a changed file is added here
+    //! @return true if the Matmakefile was changed or events was lost
+    bool read(std::vector<Task *> &changed) {
+        alignas(inotify_event) char buffer[4096];
+        bool shouldReload = false;
+
+        for (;;) {
+            auto size = ::read(_fd, buffer, sizeof(buffer));
+            if (size <= 0) {
+                break;
+            }
+
+            for (ssize_t pos = 0; pos < size;) {
+                auto event = reinterpret_cast<inotify_event *>(buffer + pos);
+                pos += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+                if (event->mask & IN_Q_OVERFLOW) {
+                    shouldReload = true;
+                    continue;
+                }
+
+                auto dirs = _dirs.find(event->wd);
+                if (dirs == _dirs.end() || !event->len) {
+                    continue;
+                }
+
+                // The same directory can be written in different ways
+                for (auto &dir : dirs->second) {
+                    auto path = (dir / event->name).string();
+                    auto file = _files.find(path);
+                    if (file == _files.end()) {
+                        continue;
+                    }
+                    statCache().invalidate(path);
+                    for (auto task : file->second) {
+                        if (task) {
+                            changed.push_back(task);
+                        }
+                        else {
+                            shouldReload = true;
+                        }
+                    }
+                }
+            }
+        }
+
+        return shouldReload;
+    }
+
+private:
+    void add(const filesystem::path &path, Task *task) {
+        auto dir = path.parent_path();
+        _files[(dir / path.filename()).string()].push_back(task);
+
+        if (!_watchedDirs.insert(dir.string()).second) {
+            return;
+        }
+
+        auto wd = inotify_add_watch(
+            _fd, dir.empty() ? "." : dir.string().c_str(), watchEventMask);
+        if (wd >= 0) {
+            _dirs[wd].push_back(dir);
+        }
+    }
+
+    //! The prescan result is only loaded again if it has been written
+    const std::vector<std::string> &includes(const Task &task) {
+        auto path = prescanResultPath(task);
+        auto mtime = statCache().stat(path).mtime;
+        auto &cached = _includes[&task];
+        if (cached.first != mtime) {
+            cached = {mtime, loadPrescanIncludes(path)};
+        }
+        return cached.second;
+    }
+
+    int _fd = -1;
+    std::unordered_map<int, std::vector<filesystem::path>> _dirs;
+    std::set<std::string> _watchedDirs;
+    std::unordered_map<std::string, std::vector<Task *>> _files;
+    std::unordered_map<const Task *,
+                       std::pair<filesystem::file_time_type,
+                                 std::vector<std::string>>>
+        _includes;
+};
+
+sockaddr_un socketAddress(const filesystem::path &path) {
+    auto address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    auto str = path.string();
+    if (str.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error{"socket path is too long: " + str};
+    }
+    str.copy(address.sun_path, str.size());
+    return address;
+}
+
+//! @return a connected socket or -1
+int connectSocket(const filesystem::path &path) {
+    auto address = socketAddress(path);
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int listenSocket(const filesystem::path &path) {
+    if (auto fd = connectSocket(path); fd >= 0) {
+        close(fd);
+        throw std::runtime_error{"matmake2 is already watching " +
+                                 path.string()};
+    }
+
+    // Left from a process that was killed
+    auto ec = std::error_code{};
+    filesystem::remove(path, ec);
+
+    auto address = socketAddress(path);
+    auto fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 ||
+        bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ||
+        listen(fd, 8)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error{"could not listen on " + path.string()};
+    }
+    return fd;
+}
+
+void sendAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        auto size = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (size <= 0) {
+            return; // The client has gone away
+        }
+        data.remove_prefix(static_cast<size_t>(size));
+    }
+}
+
+std::string receiveAll(int fd) {
+    auto data = std::string{};
+    char buffer[4096];
+    for (ssize_t size; (size = recv(fd, buffer, sizeof(buffer), 0)) > 0;) {
+        data.append(buffer, static_cast<size_t>(size));
+    }
+    return data;
+}
+
+//! The settings that changes how the tasks is built is sent with the request
+//! and used for that build only
+std::string watchRequest(const Settings &settings) {
+    auto ss = std::ostringstream{};
+    ss << "build " << settings.numThreads << " " << settings.maxFailures << " "
+       << settings.verbose << " " << settings.restat << " " << settings.maxLoad
+       << " " << settings.minMemory << "\n";
+    return ss.str();
+}
+
+//! Read a request created by watchRequest() into settings
+//! @return false if the request is invalid or needs another number of
+//!         threads, the job server can not be resized after it is created
+bool receiveRequest(int fd, Settings &settings) {
+    // The client waits for the response after sending the request, so only
+    // read until the end of the line
+    auto request = std::string{};
+    for (char c = 0; request.size() < 256 && recv(fd, &c, 1, 0) == 1;) {
+        if (c == '\n') {
+            break;
+        }
+        request.push_back(c);
+    }
+
+    auto ss = std::istringstream{request};
+    auto command = std::string{};
+    size_t numThreads = 0;
+    ss >> command >> numThreads >> settings.maxFailures >> settings.verbose >>
+        settings.restat >> settings.maxLoad >> settings.minMemory;
+
+    return ss && command == "build" && numThreads == settings.numThreads;
+}
+
+//! Send everything written to std::cout to a string instead
+class CaptureOutput {
+public:
+    CaptureOutput()
+        : _old{std::cout.rdbuf(_output.rdbuf())} {}
+
+    CaptureOutput(const CaptureOutput &) = delete;
+    CaptureOutput &operator=(const CaptureOutput &) = delete;
+
+    ~CaptureOutput() {
+        std::cout.rdbuf(_old);
+    }
+
+    std::string str() const {
+        return _output.str();
+    }
+
+private:
+    std::ostringstream _output;
+    std::streambuf *_old = nullptr;
+};
+
+#endif
+
+} // namespace
+
+filesystem::path watchSocketPath(const std::string &target) {
+    return projectStateDir() / ("watch_" + target);
+}
+
+#ifdef MATMAKE_USING_WINDOWS
+
+int watch(const Settings &, JobServer &, const std::function<TaskList()> &) {
+    throw std::runtime_error{"--watch is not supported on windows"};
+}
+
+std::optional<int> buildWithWatch(const Settings &) {
+    return {};
+}
+
+#else
+
+int watch(const Settings &settings,
+          JobServer &jobServer,
+          const std::function<TaskList()> &createTasks) {
+    auto socketPath = watchSocketPath(settings.target);
+    auto ec = std::error_code{};
+    filesystem::create_directories(socketPath.parent_path(), ec);
+    auto socketFd = listenSocket(socketPath);
+    auto watcher = FileWatcher{};
+
+    auto tasks = TaskList{};
+
+    // Errors in the Matmakefile or in source files is reported and the
+    // process waits for the next change
+    auto tryCreateTasks = [&] {
+        tasks.clear();
+        watcher.clear();
+        statCache().clear();
+        try {
+            tasks = createTasks();
+        }
+        catch (std::runtime_error &e) {
+            std::cerr << "error: " << e.what() << "\n";
+        }
+        watcher.watch(tasks);
+    };
+
+    auto build = [&](const std::vector<Task *> &changed,
+                     const Settings &buildSettings) {
+        int status = 1;
+        try {
+            // Changed sources needs to be prescanned before the state is
+            // calculated
+            prescan(tasks);
+            markDirty(tasks, changed);
+            auto coordinator = Coordinator{&jobServer};
+            status = coordinator.execute(tasks, buildSettings);
+            std::cout << (status ? "failed...\n" : "done...\n");
+        }
+        catch (std::runtime_error &e) {
+            std::cout << "error: " << e.what() << "\n";
+        }
+        std::cout.flush();
+
+        // Headers from depfiles
+        watcher.watch(tasks);
+
+        // The coordinator unblocks interrupts when it is done
+        blockInterrupts();
+        return status;
+    };
+
+    blockInterrupts();
+
+    tryCreateTasks();
+    if (!tasks.empty()) {
+        build({}, settings);
+    }
+
+    std::cout << "watching for changes...\n";
+    std::cout.flush();
+
+    auto changed = std::vector<Task *>{};
+    bool shouldReload = false;
+
+    while (!waitForInterrupt(std::chrono::milliseconds{0})) {
+        auto fds = std::array<pollfd, 2>{
+            pollfd{watcher.fd(), POLLIN, 0},
+            pollfd{socketFd, POLLIN, 0},
+        };
+
+        if (poll(fds.data(), fds.size(), 200) <= 0) {
+            continue;
+        }
+
+        if (fds.at(0).revents & POLLIN) {
+            do {
+                shouldReload |= watcher.read(changed);
+            } while (poll(fds.data(), 1, watchSettleTimeMs) > 0);
+        }
+
+        auto clientFd = -1;
+        auto clientSettings = settings;
+        if (fds.at(1).revents & POLLIN) {
+            clientFd = accept4(socketFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (clientFd >= 0) {
+                setsockopt(clientFd,
+                           SOL_SOCKET,
+                           SO_RCVTIMEO,
+                           &watchRequestTimeout,
+                           sizeof(watchRequestTimeout));
+            }
+
+            if (clientFd >= 0 && !receiveRequest(clientFd, clientSettings)) {
+                // The client builds by itself instead
+                sendAll(clientFd, watchRefusedResponse);
+                close(clientFd);
+                clientFd = -1;
+                std::cout << "refused client with other settings\n";
+                std::cout.flush();
+            }
+        }
+
+        if (changed.empty() && !shouldReload && clientFd < 0) {
+            continue;
+        }
+
+        if (shouldReload) {
+            tryCreateTasks();
+            changed.clear();
+            shouldReload = false;
+        }
+
+        if (clientFd < 0) {
+            build(changed, settings);
+        }
+        else {
+            auto output = std::string{};
+            int status = 0;
+            {
+                auto capture = CaptureOutput{};
+                status = build(changed, clientSettings);
+                output = capture.str();
+            }
+            output += std::string{watchStatusPrefix} + std::to_string(status) +
+                      "\n";
+            sendAll(clientFd, output);
+            close(clientFd);
+
+            std::cout << "built for client: "
+                      << (status ? "failed\n" : "done\n");
+        }
+
+        changed.clear();
+        std::cout << "watching for changes...\n";
+        std::cout.flush();
+    }
+
+    close(socketFd);
+    filesystem::remove(socketPath, ec);
+    unblockInterrupts();
+
+    return 0;
+}
+
+std::optional<int> buildWithWatch(const Settings &settings) {
+    auto socketPath = watchSocketPath(settings.target);
+    if (!filesystem::exists(socketPath)) {
+        return {};
+    }
+
+    auto fd = connectSocket(socketPath);
+    if (fd < 0) {
+        return {};
+    }
+
+    sendAll(fd, watchRequest(settings));
+    auto response = receiveAll(fd);
+    close(fd);
+
+    if (response == watchRefusedResponse) {
+        std::cerr << "the watching matmake2 process uses another number of "
+                     "threads, building without it\n";
+        return {};
+    }
+
+    auto f = response.rfind(watchStatusPrefix);
+    if (f == std::string::npos) {
+        std::cerr << "lost connection to the watching matmake2 process\n";
+        return 1;
+    }
+
+    std::cout << response.substr(0, f);
+    std::cout.flush();
+
+    return std::stoi(response.substr(f + watchStatusPrefix.size()));
+}
+
+#endif
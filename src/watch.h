@@ -0,0 +1,30 @@
+#pragma once
+
+#include "filesystem.h"
+#include "settings.h"
+#include "tasklist.h"
+#include <functional>
+#include <optional>
+#include <string>
+
+class JobServer;
+
+//! Socket that the watch process for a target listens on, in the build
+//! directory next to the Matmakefile
+filesystem::path watchSocketPath(const std::string &target);
+
+//! Build and keep the task list in memory. Rebuild when input files is
+//! changed or when a client asks for a build. The task list is created again
+//! when the Matmakefile is changed
+//! Runs until the process is interrupted
+//! @param createTasks creates a task list with calculated state
+int watch(const Settings &settings,
+          JobServer &jobServer,
+          const std::function<TaskList()> &createTasks);
+
+//! Let the watch process for the target do the build if there is one
+//! The settings for the build is sent to the watch process, it refuses to
+//! build if it uses another number of threads
+//! @return the status of the build, or nothing if no process is running or
+//!         it refused
+std::optional<int> buildWithWatch(const Settings &settings);
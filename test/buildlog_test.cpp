@@ -0,0 +1,109 @@
+#include "buildlog.h"
+#include "mls-unit-test/unittest.h"
+#include <fstream>
+
+namespace {
+
+const auto testPath = filesystem::current_path() / "sandbox" / "buildlog";
+
+filesystem::path setupLog() {
+    filesystem::remove_all(testPath);
+    filesystem::create_directories(testPath);
+    return testPath / ".matmake_log";
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("record and reload") {
+    auto path = setupLog();
+
+    {
+        auto log = BuildLog{path};
+        EXPECT_TRUE(log.empty());
+
+        log.startBuild();
+        log.record({0,
+                    BuildLog::Duration{10},
+                    BuildLog::Duration{30},
+                    0,
+                    0x1234,
+                    0xabcd,
+                    "build/main.o"});
+        log.record({0,
+                    BuildLog::Duration{30},
+                    BuildLog::Duration{90},
+                    1,
+                    0x5678,
+                    0,
+                    "build/main"});
+    }
+
+    auto log = BuildLog{path};
+
+    ASSERT_EQ(log.records().size(), 2);
+
+    auto record = log.latest("build/main.o");
+    ASSERT_TRUE(record);
+    EXPECT_EQ(record->commandHash, 0x1234);
+    EXPECT_EQ(record->outputHash, 0xabcd);
+    EXPECT_EQ(record->duration().count(), 20);
+
+    // Failed builds is not used for durations
+    EXPECT_EQ(log.latest("build/main")->status, 1);
+    EXPECT_FALSE(log.duration("build/main"));
+    EXPECT_EQ(log.duration("build/main.o")->count(), 20);
+}
+
+TEST_CASE("unwritable log") {
+    setupLog();
+
+    // The directory can not be created where there is a file
+    std::ofstream{testPath / "file"} << "\n";
+    auto log = BuildLog{testPath / "file" / ".matmake_log"};
+
+    log.startBuild();
+    log.record({0,
+                BuildLog::Duration{10},
+                BuildLog::Duration{30},
+                0,
+                0x1234,
+                0,
+                "build/main.o"});
+
+    // Still kept in memory
+    ASSERT_TRUE(log.latest("build/main.o"));
+    EXPECT_EQ(log.latest("build/main.o")->commandHash, 0x1234);
+}
+
+TEST_CASE("compaction") {
+    auto path = setupLog();
+
+    {
+        auto file = std::ofstream{path};
+        file << "# matmake2 log v3\n";
+
+        // The same file built in a lot of different builds
+        for (size_t build = 1; build <= 100; ++build) {
+            file << build << "\t0\t" << build << "\t0\t0000000000000001\t"
+                 << "0000000000000000\tbuild/main.o\n";
+        }
+
+        // Only built once in the first build
+        file << "1\t0\t5\t0\t0000000000000002\t0000000000000000\t"
+             << "build/other.o\n";
+    }
+
+    auto log = BuildLog{path};
+
+    // Should keep the 20 last builds and the latest build of other.o
+    EXPECT_EQ(log.records().size(), 21);
+    EXPECT_EQ(log.duration("build/main.o")->count(), 100);
+    EXPECT_EQ(log.duration("build/other.o")->count(), 5);
+
+    // The compacted log should be written back to disk
+    EXPECT_EQ(BuildLog{path}.records().size(), 21);
+}
+
+TEST_SUIT_END
@@ -0,0 +1,99 @@
+#include "depslog.h"
+#include "mls-unit-test/unittest.h"
+#include <fstream>
+
+namespace {
+
+const auto testPath = filesystem::current_path() / "sandbox" / "depslog";
+
+filesystem::path setupLog() {
+    filesystem::remove_all(testPath);
+    filesystem::create_directories(testPath);
+    return testPath / ".matmake_deps";
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("record and reload") {
+    auto path = setupLog();
+
+    {
+        auto log = DepsLog{path};
+        EXPECT_EQ(log.size(), 0);
+
+        log.record("build/main.o", 10, {"./src/main.h", "./src/common.h"});
+        log.record("build/other.o", 20, {"./src/common.h"});
+        log.record("build/main.o", 30, {"./src/main.h"});
+    }
+
+    auto log = DepsLog{path};
+
+    ASSERT_EQ(log.size(), 2);
+
+    auto record = log.find("build/main.o");
+    ASSERT_TRUE(record);
+    EXPECT_EQ(record->mtime, 30);
+    ASSERT_EQ(record->deps.size(), 1);
+    EXPECT_EQ(*record->deps.front(), "./src/main.h");
+
+    record = log.find("build/other.o");
+    ASSERT_TRUE(record);
+    ASSERT_EQ(record->deps.size(), 1);
+    EXPECT_EQ(*record->deps.front(), "./src/common.h");
+
+    EXPECT_FALSE(log.find("build/missing.o"));
+}
+
+TEST_CASE("truncated file") {
+    auto path = setupLog();
+
+    {
+        auto log = DepsLog{path};
+        log.record("build/main.o", 10, {"./src/main.h"});
+        log.record("build/other.o", 20, {"./src/other.h"});
+    }
+
+    // Simulate a write that was interrupted
+    filesystem::resize_file(path, filesystem::file_size(path) - 2);
+
+    {
+        auto log = DepsLog{path};
+        EXPECT_EQ(log.size(), 1);
+        EXPECT_TRUE(log.find("build/main.o"));
+
+        log.record("build/third.o", 30, {"./src/main.h"});
+    }
+
+    auto log = DepsLog{path};
+    EXPECT_EQ(log.size(), 2);
+    EXPECT_TRUE(log.find("build/third.o"));
+}
+
+TEST_CASE("compaction") {
+    auto path = setupLog();
+
+    {
+        auto log = DepsLog{path};
+        for (int i = 0; i < 1000; ++i) {
+            log.record("build/main.o", i, {"./src/main.h"});
+        }
+    }
+
+    auto sizeBefore = filesystem::file_size(path);
+
+    {
+        auto log = DepsLog{path};
+        ASSERT_EQ(log.size(), 1);
+        EXPECT_EQ(log.find("build/main.o")->mtime, 999);
+    }
+
+    EXPECT_TRUE(filesystem::file_size(path) < sizeBefore);
+
+    auto log = DepsLog{path};
+    ASSERT_EQ(log.size(), 1);
+    EXPECT_EQ(log.find("build/main.o")->mtime, 999);
+}
+
+TEST_SUIT_END
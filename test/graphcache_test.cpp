@@ -0,0 +1,116 @@
+#include "graphcache.h"
+#include "mls-unit-test/unittest.h"
+#include "statcache.h"
+#include <chrono>
+#include <fstream>
+
+namespace {
+
+const auto testPath = filesystem::current_path() / "sandbox" / "graphcache";
+
+//! Tasks that looks like the ones created for a single source file
+TaskList createTestTasks() {
+    auto tasks = TaskList{};
+
+    auto &root = tasks.emplace();
+    root.name(std::string{"gcc"});
+    root.command("[root]");
+    root.dir(BuildLocation::Intermediate, "obj");
+    root.flags("-O2");
+    root.commands({{"cxx", "{c++} {flags}"}});
+
+    auto &exe = tasks.emplace();
+    exe.name(std::string{"main"});
+    exe.out("main");
+    exe.parent(&root);
+
+    auto &object = tasks.emplace();
+    object.out("obj/main.o");
+    object.command("[cxx]");
+    object.parent(&exe);
+
+    auto &source = tasks.emplace();
+    source.out("./main.cpp");
+
+    exe.pushIn(&object);
+    object.pushIn(&source);
+
+    return tasks;
+}
+
+//! Move the time stamps back so that the files does not look like they was
+//! changed at the same time as the graph was saved
+void makeOld(const std::vector<filesystem::path> &paths) {
+    auto old = filesystem::file_time_type::clock::now() - std::chrono::hours{1};
+    for (auto &path : paths) {
+        filesystem::last_write_time(path, old);
+    }
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("save and load") {
+    filesystem::remove_all(testPath);
+    filesystem::create_directories(testPath / "obj");
+    filesystem::create_directories(testPath / projectStateDir());
+    filesystem::current_path(testPath);
+
+    std::ofstream{"Matmakefile"} << "main\n  src = *.cpp\n";
+    std::ofstream{"main.cpp"} << "int main() {}\n";
+    makeOld({"Matmakefile", "main.cpp", "."});
+    statCache().clear();
+
+    saveGraphCache("gcc", createTestTasks(), {"."});
+
+    {
+        auto tasks = loadGraphCache("gcc");
+        ASSERT_TRUE(tasks);
+        ASSERT_EQ(tasks->size(), 4);
+
+        auto &root = tasks->at(0);
+        EXPECT_EQ(root.name(), "gcc");
+        EXPECT_TRUE(root.isRoot());
+        EXPECT_EQ(root.dir(BuildLocation::Intermediate), "obj");
+        EXPECT_EQ(root.commands().at("cxx"), "{c++} {flags}");
+
+        auto &object = tasks->at(2);
+        EXPECT_EQ(object.out(), "obj/main.o");
+        EXPECT_EQ(object.command(), "{c++} {flags}");
+        EXPECT_EQ(object.flags(), "-O2");
+        EXPECT_EQ(object.parent(), &tasks->at(1));
+        ASSERT_EQ(object.in().size(), 1);
+        EXPECT_EQ(object.in().front(), &tasks->at(3));
+    }
+
+    // A new source file in a searched directory makes the graph out of date
+    std::ofstream{"other.cpp"} << "\n";
+    statCache().clear();
+    EXPECT_FALSE(loadGraphCache("gcc"));
+
+    EXPECT_FALSE(loadGraphCache("clang"));
+}
+
+TEST_CASE("racily clean files") {
+    filesystem::remove_all(testPath);
+    filesystem::create_directories(testPath / "obj");
+    filesystem::create_directories(testPath / projectStateDir());
+    filesystem::current_path(testPath);
+
+    std::ofstream{"Matmakefile"} << "main\n  src = *.cpp\n";
+    std::ofstream{"main.cpp"} << "int main() {}\n";
+    makeOld({"main.cpp", "."});
+
+    // Changed after the graph is saved, but with the same time stamp
+    filesystem::last_write_time(
+        "Matmakefile",
+        filesystem::file_time_type::clock::now() + std::chrono::hours{1});
+    statCache().clear();
+
+    saveGraphCache("gcc", createTestTasks(), {"."});
+    statCache().clear();
+    EXPECT_FALSE(loadGraphCache("gcc"));
+}
+
+TEST_SUIT_END
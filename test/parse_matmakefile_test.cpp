@@ -1,6 +1,7 @@
 #define DO_NOT_CATCH_ERRORS
 
 #include "line.h"
+#include "matmakefile.h"
 #include "mls-unit-test/unittest.h"
 #include "parsematmakefile.h"
 
@@ -103,4 +104,36 @@ main
     ASSERT_EQ(first["in"].back().string(), "src/*.cppm");
 }
 
+TEST_CASE("MatmakeFile: merge") {
+    auto content = std::istringstream{R"_(
+main
+  out = main
+
+main
+  flags = -O2
+
+release
+  root = root
+
+debug
+  root = root
+
+!debug
+  flags = -g
+)_"};
+
+    const auto file = MatmakeFile{parseMatmakefile(content)};
+
+    auto main = file.find("main");
+    ASSERT_TRUE(main);
+    ASSERT_EQ(main->property("out")->value(), "main");
+    ASSERT_EQ(main->property("flags")->value(), "-O2");
+
+    // "!debug" is merged into all root nodes except debug
+    ASSERT_EQ(file.find("release")->property("flags")->value(), "-g");
+    ASSERT_FALSE(file.find("debug")->property("flags"));
+    ASSERT_FALSE(file.find("!debug"));
+    ASSERT_FALSE(file.find("other"));
+}
+
 TEST_SUIT_END
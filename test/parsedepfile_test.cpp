@@ -0,0 +1,76 @@
+#include "parsedepfile.h"
+#include "mls-unit-test/unittest.h"
+
+namespace {
+
+DepFileContent parse(std::string text) {
+    auto content = DepFileContent{};
+    content.buffer = std::move(text);
+    parseDepFileBuffer(content);
+    return content;
+}
+
+} // namespace
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("simple rule") {
+    auto content = parse("build/main.o: src/main.cpp src/main.h\n");
+
+    ASSERT_EQ(content.deps.size(), 2);
+    EXPECT_EQ(content.deps.at(0), "./src/main.cpp");
+    EXPECT_EQ(content.deps.at(1), "./src/main.h");
+}
+
+TEST_CASE("continuations and carriage returns") {
+    auto content = parse("build/main.o: \\\n src/a.h \\\r\n  src/b.h\r\n");
+
+    ASSERT_EQ(content.deps.size(), 2);
+    EXPECT_EQ(content.deps.at(0), "./src/a.h");
+    EXPECT_EQ(content.deps.at(1), "./src/b.h");
+}
+
+TEST_CASE("escaped characters") {
+    auto content = parse("out.o: src/with\\ space.h src/dollar$$.h src/\\#.h");
+
+    ASSERT_EQ(content.deps.size(), 3);
+    EXPECT_EQ(content.deps.at(0), "./src/with space.h");
+    EXPECT_EQ(content.deps.at(1), "./src/dollar$.h");
+    EXPECT_EQ(content.deps.at(2), "./src/#.h");
+}
+
+TEST_CASE("skip absolute paths and other rules") {
+    auto content =
+        parse("out.o other.o: /usr/include/stdio.h src/a.h\nsrc/a.h:\n");
+
+    ASSERT_EQ(content.deps.size(), 1);
+    EXPECT_EQ(content.deps.at(0), "./src/a.h");
+}
+
+TEST_CASE("embedded null character") {
+    const char text[] = "out.o: src/a.h\0src/b.h \0\n";
+    auto content = parse(std::string{text, sizeof(text) - 1});
+
+    ASSERT_EQ(content.deps.size(), 2);
+    EXPECT_EQ(content.deps.at(0), "./src/a.h");
+    EXPECT_EQ(content.deps.at(1), "./src/b.h");
+}
+
+TEST_CASE("reuse content") {
+    auto content = parse("a.o: a.h b.h c.h");
+    EXPECT_EQ(content.deps.size(), 3);
+
+    content.buffer = "b.o: d.h";
+    parseDepFileBuffer(content);
+
+    ASSERT_EQ(content.deps.size(), 1);
+    EXPECT_EQ(content.deps.at(0), "./d.h");
+}
+
+TEST_CASE("missing file") {
+    auto content = DepFileContent{};
+    EXPECT_FALSE(parseDepFile("sandbox/does-not-exist.d", content));
+    EXPECT_TRUE(content.deps.empty());
+}
+
+TEST_SUIT_END
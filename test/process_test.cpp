@@ -0,0 +1,88 @@
+#include "mls-unit-test/unittest.h"
+#include "process.h"
+#include <thread>
+
+TEST_SUIT_BEGIN
+
+TEST_CASE("splitCommand: simple command") {
+    auto args = std::vector<std::string>{};
+
+    ASSERT_EQ(splitCommand("g++  -c main.cpp -o main.o ", args), true);
+    ASSERT_EQ(args.size(), 5);
+    EXPECT_EQ(args.at(0), "g++");
+    EXPECT_EQ(args.at(1), "-c");
+    EXPECT_EQ(args.at(4), "main.o");
+}
+
+TEST_CASE("splitCommand: quotes") {
+    auto args = std::vector<std::string>{};
+
+    ASSERT_EQ(splitCommand(R"(g++ -Wl,-rpath='$$ORIGIN' "a b" c\ d "")",
+                           args),
+              true);
+    ASSERT_EQ(args.size(), 5);
+    EXPECT_EQ(args.at(1), "-Wl,-rpath=$$ORIGIN");
+    EXPECT_EQ(args.at(2), "a b");
+    EXPECT_EQ(args.at(3), "c d");
+    EXPECT_EQ(args.at(4), "");
+}
+
+TEST_CASE("splitCommand: requires shell") {
+    auto args = std::vector<std::string>{};
+
+    EXPECT_EQ(splitCommand("g++ main.cpp -E > main.eem", args), false);
+    EXPECT_EQ(splitCommand("a | b", args), false);
+    EXPECT_EQ(splitCommand("echo $HOME", args), false);
+    EXPECT_EQ(splitCommand("echo \"$HOME\"", args), false);
+    EXPECT_EQ(splitCommand("CXX=g++ make", args), false);
+    EXPECT_EQ(splitCommand("echo 'unterminated", args), false);
+}
+
+TEST_CASE("runProcess") {
+    {
+        auto result = runProcess("echo hello");
+        EXPECT_EQ(result.status, 0);
+        EXPECT_EQ(result.output, "hello\n");
+        EXPECT_NE(result.pid, 0);
+    }
+
+    {
+        auto result = runProcess("echo error 1>&2; exit 3");
+        EXPECT_EQ(result.status, 3);
+        EXPECT_EQ(result.output, "error\n");
+    }
+
+    {
+        auto result = runProcess("matmake2-command-that-does-not-exist");
+        EXPECT_NE(result.status, 0);
+    }
+
+    {
+        auto result =
+            runProcess("echo inherited", {}, nullptr, ProcessOutput::Inherit);
+        EXPECT_EQ(result.status, 0);
+        EXPECT_EQ(result.output, "");
+    }
+}
+
+TEST_CASE("ProcessGroups: stop") {
+    using namespace std::chrono_literals;
+
+    auto groups = ProcessGroups{};
+    auto result = ProcessResult{};
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto thread = std::thread{
+        [&] { result = runProcess("sleep 10; echo done", {}, &groups); }};
+
+    std::this_thread::sleep_for(100ms);
+    groups.stop(1s);
+    thread.join();
+
+    EXPECT_NE(result.status, 0);
+    EXPECT_EQ(result.output, "");
+    EXPECT_TRUE(std::chrono::steady_clock::now() - start < 5s);
+}
+
+TEST_SUIT_END
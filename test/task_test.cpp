@@ -1,5 +1,8 @@
 #include "mls-unit-test/unittest.h"
 #include "task.h"
+#include "tasklist.h"
+#include <chrono>
+#include <fstream>
 
 TEST_SUIT_BEGIN
 
@@ -90,4 +93,296 @@ TEST_CASE("property: includes") {
     EXPECT_EQ(task.includes(), "-Itest1 -Itest2");
 }
 
+TEST_CASE("sortTasks: levels") {
+    auto tasks = TaskList{};
+
+    auto &exe = tasks.emplace();
+    auto &object1 = tasks.emplace();
+    auto &object2 = tasks.emplace();
+    auto &source = tasks.emplace();
+
+    exe.pushIn(&object1);
+    exe.pushIn(&object2);
+    object1.pushIn(&source);
+    object2.pushIn(&object1);
+
+    auto levels = sortTasks(tasks);
+
+    ASSERT_EQ(levels.size(), 4);
+    EXPECT_EQ(levels.at(0).front(), &source);
+    EXPECT_EQ(levels.at(1).front(), &object1);
+    EXPECT_EQ(levels.at(2).front(), &object2);
+    EXPECT_EQ(levels.at(3).front(), &exe);
+}
+
+TEST_CASE("sortTasks: cycle") {
+    auto tasks = TaskList{};
+
+    auto &a = tasks.emplace();
+    auto &b = tasks.emplace();
+    auto &c = tasks.emplace();
+
+    a.name(std::string{"a"});
+    b.name(std::string{"b"});
+    c.name(std::string{"c"});
+
+    a.pushIn(&b);
+    b.pushIn(&c);
+    c.pushIn(&a);
+
+    auto message = std::string{};
+    try {
+        sortTasks(tasks);
+    }
+    catch (std::runtime_error &e) {
+        message = e.what();
+    }
+
+    EXPECT_NE(message.find("a -> b -> c -> a"), std::string::npos);
+}
+
+TEST_CASE("TaskList: find") {
+    auto tasks = TaskList{};
+
+    auto &exe = tasks.emplace();
+    auto &object = tasks.emplace();
+    auto &header = tasks.emplace();
+
+    exe.name(std::string{"main"});
+    exe.out("main");
+    exe.dir(BuildLocation::Real, "build");
+    object.out("main.o");
+    header.out("./src/main.h");
+    exe.pushIn(&object);
+
+    EXPECT_EQ(tasks.find("@main"), &exe);
+    EXPECT_EQ(tasks.find("./src/main.h"), &header);
+    EXPECT_EQ(tasks.find("build/main.o"), &object);
+    EXPECT_FALSE(tasks.find("@other"));
+    EXPECT_FALSE(tasks.find(""));
+
+    // Changes after the first lookup is found
+    exe.name(std::string{"renamed"});
+    exe.dir(BuildLocation::Real, "out");
+    EXPECT_FALSE(tasks.find("@main"));
+    EXPECT_EQ(tasks.find("@renamed"), &exe);
+    EXPECT_EQ(tasks.find("out/main.o"), &object);
+
+    auto &added = tasks.emplace();
+    added.out("./src/added.h");
+    EXPECT_EQ(tasks.find("./src/added.h"), &added);
+}
+
+TEST_CASE("TaskList: find while connecting") {
+    // Connecting a task changes its output path, this used to rebuild all
+    // lookup tables on the next find, which made this take minutes
+    constexpr auto numObjects = 4000;
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto tasks = TaskList{};
+    auto &exe = tasks.emplace();
+    exe.name(std::string{"main"});
+    exe.dir(BuildLocation::Real, "build");
+
+    for (int i = 0; i < numObjects; ++i) {
+        auto &source = tasks.emplace();
+        source.out("./src/" + std::to_string(i) + ".cpp");
+        auto &object = tasks.emplace();
+        object.out(std::to_string(i) + ".o");
+    }
+
+    for (int i = 0; i < numObjects; ++i) {
+        auto name = std::to_string(i);
+        auto object = tasks.find(name + ".o");
+        ASSERT_TRUE(object);
+        object->pushIn(tasks.find("./src/" + name + ".cpp"));
+        tasks.find("@main")->pushIn(object);
+    }
+
+    EXPECT_EQ(tasks.find("build/0.o"), &tasks.at(2));
+    EXPECT_FALSE(tasks.find("0.o"));
+    EXPECT_EQ(exe.in().size(), numObjects);
+
+    auto duration = std::chrono::steady_clock::now() - start;
+    EXPECT_TRUE(duration < std::chrono::seconds{5});
+}
+
+TEST_CASE("TaskList: insert") {
+    auto tasks = TaskList{};
+    auto &exe = tasks.emplace();
+
+    auto other = TaskList{};
+    auto &object = other.emplace();
+    auto &source = other.emplace();
+    exe.pushIn(&object);
+    object.pushIn(&source);
+
+    // The tasks is not moved in memory
+    tasks.insert(std::move(other));
+    EXPECT_EQ(tasks.size(), 3);
+    EXPECT_EQ(&tasks.at(1), &object);
+    EXPECT_EQ(object.index(), 1);
+    EXPECT_EQ(source.index(), 2);
+    EXPECT_TRUE(tasks.contains(&source));
+
+    auto graph = createTaskGraph(tasks);
+    EXPECT_EQ(graph.subscribers(0).size(), 0);
+    EXPECT_EQ(*graph.subscribers(1).begin(), 0);
+    EXPECT_EQ(*graph.subscribers(2).begin(), 1);
+}
+
+TEST_CASE("TaskList: blocks") {
+    auto tasks = TaskList{};
+    auto &first = tasks.emplace();
+
+    // More than fits in one block
+    for (size_t i = 1; i < TaskBlock::capacity * 2 + 1; ++i) {
+        tasks.emplace();
+    }
+
+    EXPECT_EQ(&tasks.at(0), &first);
+    EXPECT_EQ(tasks.back().index(), TaskBlock::capacity * 2);
+    EXPECT_TRUE(tasks.contains(&tasks.back()));
+
+    auto moved = std::move(tasks);
+    EXPECT_EQ(&moved.at(0), &first);
+}
+
+TEST_CASE("TaskGraph: loadState") {
+    auto tasks = TaskList{};
+    auto &exe = tasks.emplace();
+    auto &object1 = tasks.emplace();
+    auto &object2 = tasks.emplace();
+    auto &source = tasks.emplace();
+    exe.pushIn(&object1);
+    exe.pushIn(&object2);
+    object1.pushIn(&source);
+    object2.pushIn(&source);
+
+    exe.setState(TaskState::DirtyWaiting);
+    object1.setState(TaskState::DirtyReady);
+    object2.setState(TaskState::Fresh);
+    source.setState(TaskState::Raw);
+
+    auto graph = createTaskGraph(tasks);
+    graph.loadState(tasks);
+
+    EXPECT_EQ(graph.states.at(0), TaskState::DirtyWaiting);
+    EXPECT_EQ(graph.numPending.at(0), 1);
+    EXPECT_EQ(graph.numPending.at(1), 0);
+
+    // Nothing to wait for
+    object1.setState(TaskState::Fresh);
+    graph.loadState(tasks);
+    EXPECT_EQ(graph.states.at(0), TaskState::DirtyReady);
+}
+
+TEST_CASE("markDirty") {
+    const auto dir = filesystem::path{"./sandbox/markdirty"};
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+
+    std::ofstream{dir / "main.cpp"} << "int main() {}\n";
+    std::ofstream{dir / "main.o"} << "\n";
+    filesystem::last_write_time(
+        dir / "main.o",
+        filesystem::last_write_time(dir / "main.cpp") + std::chrono::seconds{1});
+
+    auto tasks = TaskList{};
+    auto &object = tasks.emplace();
+    auto &source = tasks.emplace();
+    object.out(dir / "main.o");
+    source.out(dir / "main.cpp");
+    object.pushIn(&source);
+
+    // Without output, like the root
+    auto &root = tasks.emplace();
+    root.pushIn(&object);
+
+    markDirty(tasks, {});
+    EXPECT_EQ(source.state(), TaskState::Raw);
+    EXPECT_EQ(object.state(), TaskState::Fresh);
+    EXPECT_EQ(root.state(), TaskState::Fresh);
+
+    // Nothing has changed
+    markDirty(tasks, {});
+    EXPECT_EQ(object.state(), TaskState::Fresh);
+
+    filesystem::last_write_time(
+        dir / "main.cpp",
+        filesystem::last_write_time(dir / "main.o") + std::chrono::seconds{1});
+
+    markDirty(tasks, {&source});
+    EXPECT_EQ(object.state(), TaskState::DirtyReady);
+    EXPECT_EQ(root.state(), TaskState::DirtyWaiting);
+
+    filesystem::remove_all(dir);
+}
+
+TEST_CASE("shareProperties") {
+    auto a = Task{};
+    auto b = Task{};
+
+    a.flags("-O2");
+    b.flags("-O2");
+    b.shareProperties(a);
+
+    // Changing shared properties does not change the other task
+    b.flags("-O0");
+    EXPECT_EQ(a.flags(), "-O2");
+    EXPECT_EQ(b.flags(), "-O0");
+
+    // Tasks without properties inherits from the parent
+    auto child = Task{};
+    child.parent(&a);
+    EXPECT_EQ(child.flags(), "-O2");
+    EXPECT_EQ(child.commands().size(), 0);
+}
+
+TEST_CASE("resolveProperties") {
+    auto parent = Task{};
+    auto child = Task{};
+    child.parent(&parent);
+    parent.flags("-O2");
+    parent.command("{cxx} {flags}");
+
+    child.resolveProperties();
+    EXPECT_EQ(child.flags(), "-O2");
+    EXPECT_EQ(child.command(), "{cxx} {flags}");
+
+    // Changing the parent makes the resolved values out of date
+    parent.flags("-O0");
+    EXPECT_EQ(child.flags(), "-O0");
+
+    child.resolveProperties();
+    EXPECT_EQ(child.flags(), "-O0");
+
+    child.flags("-g");
+    EXPECT_EQ(child.flags(), "-g");
+}
+
+TEST_CASE("ProcessedCommand") {
+    auto parent = Task{};
+    auto task = Task{};
+    task.parent(&parent);
+    parent.flags("-O2");
+    parent.cxx("c++");
+    task.out("main.o");
+
+    auto &command = ProcessedCommand::cached("{c++} {flags} -o {out} -c");
+    EXPECT_EQ(&command, &ProcessedCommand::cached("{c++} {flags} -o {out} -c"));
+    EXPECT_EQ(command.expand(task), "c++ -O2 -o main.o -c");
+
+    // Text after the last reference and unknown names
+    EXPECT_EQ(ProcessedCommand{"a {x} b {"}.expand(task), "a  b {");
+    EXPECT_EQ(ProcessedCommand{"{parent.out}"}.expand(task), "");
+    EXPECT_EQ(ProcessedCommand{"{parent.flags}"}.expand(task), "-O2");
+
+    // Expansion appends to the buffer
+    auto buffer = std::string{"> "};
+    command.expand(task, buffer);
+    EXPECT_EQ(buffer, "> c++ -O2 -o main.o -c");
+}
+
 TEST_SUIT_END